@@ -0,0 +1,75 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#pragma once
+
+#include "config.hpp"
+#include "sdl.hpp"
+#include "sinks.hpp"
+#include "spsc_ring.hpp"
+#include "waveform_generator.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace nchip8 {
+    // Plays the beeper tone through an SDL audio device.
+    //
+    // The samples are generated by the audio callback on SDL's audio thread. The emulation only reports the frames
+    // (see AudioSink) and schedules every start and stop of the tone to a sample in the near future, the configured
+    // latency ahead of what is being played. The events are passed to the callback through a lock-free ring, so a
+    // slow frame delays neither of the sides. If the frames stop coming (e.g. the VM is paused), the tone stops at
+    // the end of the last reported frame.
+    class AudioOutput : public AudioSink {
+    public:
+        AudioOutput(const SoundConfig &cfg);
+
+        void frame(bool toneOn) override;
+
+        // Must be called after the waveform, the level or the frequency in the config is changed
+        void applyConfig();
+
+        // From reporting a start or a stop of the tone to hearing it, measured by the callback
+        std::chrono::microseconds latency() const;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        // size is in samples, not in bytes (one sample is two bytes)
+        static constexpr int BUFFER_SIZE = 256;
+        static constexpr std::uint64_t FRAME_SAMPLES = WaveformGenerator::SAMPLE_RATE / TIMER_FREQ;
+
+        static_assert(WaveformGenerator::SAMPLE_RATE % TIMER_FREQ == 0, "a frame must have a whole number of samples");
+
+        struct ToneEvent {
+            // Position in the samples played since the device was opened
+            std::uint64_t sample;
+            bool on;
+            Clock::time_point reported;
+        };
+
+        // The audio callback
+        void fill(std::uint8_t *stream, int len);
+
+        const SoundConfig &m_cfg;
+        WaveformGenerator m_generator;
+
+        SpscRing<ToneEvent, 64> m_events;
+        // Written only by the callback
+        std::atomic<std::uint64_t> m_playedSamples = 0;
+        // The tone isn't played past the end of the last reported frame
+        std::atomic<std::uint64_t> m_scheduledEnd = 0;
+        std::atomic<std::int64_t> m_latency = 0;
+
+        // Used only by the emulation side
+        std::uint64_t m_frameStart = 0;
+        bool m_reportedOn = false;
+
+        // Used only by the callback
+        bool m_toneOn = false;
+
+        // Last, as the callback starts running as soon as the device is opened
+        sdl::AudioDevice m_audioDevice;
+    };
+}
@@ -0,0 +1,114 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace nchip8 {
+    // Builds the files of nCHIP-8 (movies, save states). All integers are little-endian, whatever the host is.
+    class ByteWriter {
+    public:
+        void u8(std::uint8_t value) {
+            bytes.push_back(value);
+        }
+
+        void u16(std::uint16_t value) {
+            uint(value, 2);
+        }
+
+        void u32(std::uint32_t value) {
+            uint(value, 4);
+        }
+
+        void u64(std::uint64_t value) {
+            uint(value, 8);
+        }
+
+        // LEB128, 7 bits per byte
+        void varint(std::uint64_t value) {
+            while (value >= 0x80) {
+                u8((std::uint8_t) (value | 0x80));
+                value >>= 7;
+            }
+
+            u8((std::uint8_t) value);
+        }
+
+        std::vector<std::uint8_t> bytes;
+
+    private:
+        void uint(std::uint64_t value, int size) {
+            for (int i = 0; i < size; ++i) {
+                u8((std::uint8_t) (value >> (i * 8)));
+            }
+        }
+    };
+
+    // The counterpart of ByteWriter. Throws Error if the bytes end too soon or a varint is malformed.
+    template <typename Error>
+    class ByteReader {
+    public:
+        // what names the data in the error messages (e.g. "the movie file")
+        ByteReader(const std::vector<std::uint8_t> &bytes, std::string what)
+            : m_bytes { bytes }, m_what { std::move(what) } {
+        }
+
+        std::uint8_t u8() {
+            if (m_pos >= m_bytes.size()) {
+                throw Error(m_what + " is truncated");
+            }
+
+            return m_bytes[m_pos++];
+        }
+
+        std::uint16_t u16() {
+            return (std::uint16_t) uint(2);
+        }
+
+        std::uint32_t u32() {
+            return (std::uint32_t) uint(4);
+        }
+
+        std::uint64_t u64() {
+            return uint(8);
+        }
+
+        std::uint64_t varint() {
+            std::uint64_t value = 0;
+
+            for (int shift = 0; shift < 64; shift += 7) {
+                std::uint8_t byte = u8();
+                value |= (std::uint64_t) (byte & 0x7f) << shift;
+
+                if (!(byte & 0x80)) {
+                    return value;
+                }
+            }
+
+            throw Error(m_what + " is corrupted");
+        }
+
+        bool atEnd() const {
+            return m_pos == m_bytes.size();
+        }
+
+    private:
+        std::uint64_t uint(int size) {
+            std::uint64_t value = 0;
+
+            for (int i = 0; i < size; ++i) {
+                value |= (std::uint64_t) u8() << (i * 8);
+            }
+
+            return value;
+        }
+
+        const std::vector<std::uint8_t> &m_bytes;
+        std::string m_what;
+        std::size_t m_pos = 0;
+    };
+}
@@ -12,7 +12,7 @@ namespace nchip8 {
         std::string name;
         std::uint16_t offset;
 
-        inline constexpr bool operator==(const Breakpoint &breakpoint) const {
+        inline bool operator==(const Breakpoint &breakpoint) const {
             return name == breakpoint.name && offset == breakpoint.offset;
         }
     };
@@ -3,20 +3,23 @@
 
 #pragma once
 
-#include "waveform_generator.hpp"
+#include "cpu_config.hpp"
 #include "display.hpp"
 #include "sdl.hpp"
+#include "types.hpp"
+#include "vm.hpp"
+#include "waveform_generator.hpp"
 #include "ui/ui_style.hpp"
 
 #include <array>
-#include <ctime>
+#include <cstdint>
 #include <ostream>
 #include <string>
 
 namespace nchip8 {
     inline constexpr const char *CONFIG_FILENAME = ".nchip8.toml";
-    inline constexpr int KEY_COUNT = 16;
-
+    // Held to run the game backwards
+    inline constexpr SDL_Scancode REWIND_KEY = SDL_SCANCODE_BACKSPACE;
     using InputLayout = std::array<std::pair<SDL_Scancode, int>, KEY_COUNT>;
 
     inline constexpr InputLayout ORIGINAL_LAYOUT { {
@@ -63,12 +66,19 @@ namespace nchip8 {
         { SDL_SCANCODE_V, 0xF }
     } };
 
+    // The key bound to every scancode, or -1
+    using KeyMap = std::array<std::int8_t, SDL_NUM_SCANCODES>;
+
+    KeyMap makeKeyMap(const InputLayout &layout);
+
     namespace default_values {
         namespace graphics {
-            inline constexpr sdl::Color OFF_COLOR    = { 0x00, 0x00, 0x00, 0xff };
-            inline constexpr sdl::Color ON_COLOR     = { 0x00, 0x00, 0x00, 0xff };
-            inline constexpr sdl::Point WINDOW_SIZE  = LORES_DISPLAY_SIZE * 10;
-            inline constexpr int        SCALE_FACTOR = 1;
+            inline constexpr Color OFF_COLOR    = { 0x00, 0x00, 0x00, 0xff };
+            inline constexpr Color ON_COLOR     = { 0x00, 0x00, 0x00, 0xff };
+            inline constexpr Point WINDOW_SIZE  = LORES_DISPLAY_SIZE * 10;
+            inline constexpr int   SCALE_FACTOR = 1;
+            inline constexpr bool  VSYNC        = true;
+            inline constexpr int   FRAME_CAP    = 60;
         }
 
         namespace input {
@@ -86,6 +96,7 @@ namespace nchip8 {
             inline constexpr double   LEVEL     = 3.00; // dB
             inline constexpr int      FREQUENCY = 440;
             inline constexpr Waveform WAVEFORM  = Waveform::SQUARE;
+            inline constexpr int      LATENCY   = 50; // ms
         }
 
         namespace ui {
@@ -94,11 +105,14 @@ namespace nchip8 {
     };
 
     struct GraphicsConfig {
-        sdl::Color offColor   = { 0x00, 0x00, 0x00, 0xff };
-        sdl::Color onColor    = { 0xff, 0xff, 0xff, 0xff };
-        sdl::Point windowSize = LORES_DISPLAY_SIZE * 10;
+        Color offColor   = { 0x00, 0x00, 0x00, 0xff };
+        Color onColor    = { 0xff, 0xff, 0xff, 0xff };
+        Point windowSize = LORES_DISPLAY_SIZE * 10;
         int scaleFactor = 1;
         bool enableFade = false;
+        bool vsync = true;
+        // Frames per second when vsync is off or not supported, 0 for no limit
+        int frameCap = 60;
     };
 
     struct InputConfig {
@@ -106,23 +120,13 @@ namespace nchip8 {
         InputLayout layout = MODERN_LAYOUT;
     };
 
-    struct CPUConfig {
-        unsigned cyclesPerSec      = 250;
-        bool     uncapCyclesPerSec = false;
-        unsigned rngSeed           = (unsigned) time(NULL);
-        bool     debugMode         = false;
-
-        // By SCHIP design, these were supposed to be the RPL user flags on HP-48.
-        //
-        // SCHIP/XO-CHIP only
-        std::uint64_t rplFlags = 0;
-    };
-
     struct SoundConfig {
         bool     enable    = true;
         double   level     = 3.00; // dB
         int      frequency = 440;
         Waveform waveform  = Waveform::SQUARE;
+        // From the frame that starts or stops the tone to hearing it
+        int      latencyMs = 50;
     };
 
     struct UIConfig {
@@ -0,0 +1,31 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+
+namespace nchip8 {
+    struct CPUConfig {
+        unsigned cyclesPerSec      = 250;
+        bool     uncapCyclesPerSec = false;
+        bool     useRecompiler     = false;
+        unsigned rngSeed           = (unsigned) time(NULL);
+        bool     debugMode         = false;
+
+        // Limits of the rewind history (see Rewinder), the older frames are forgotten. 0 seconds disables rewinding.
+        unsigned rewindSeconds  = 300;
+        unsigned rewindMemoryMB = 64;
+
+        // Frames emulated ahead with the current keys to hide the input lag of the games, only the last one is shown
+        // (see VM::runFrame()). 0 disables running ahead.
+        unsigned runAheadFrames = 0;
+
+        // By SCHIP design, these were supposed to be the RPL user flags on HP-48. The VM keeps its own copy in
+        // VMState::rplFlags, this is just the initial value (the flags of the last session in the GUI).
+        //
+        // SCHIP/XO-CHIP only
+        std::uint64_t rplFlags = 0;
+    };
+}
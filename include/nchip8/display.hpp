@@ -3,22 +3,15 @@
 
 #pragma once
 
-#include "sdl.hpp"
+#include "types.hpp"
 
-#include <bitset>
+#include <array>
 #include <cstddef>
 #include <cstdint>
-#include <deque>
-#include <unordered_set>
-#include <vector>
 
 namespace nchip8 {
-    inline constexpr sdl::Point  LORES_DISPLAY_SIZE  = { 64, 32 };
-    inline constexpr sdl::Point  HIRES_DISPLAY_SIZE  = { 128, 64 };
-    inline constexpr sdl::Point  LORES_PIXEL_SIZE    = { 10, 10 };
-    inline constexpr sdl::Point  HIRES_PIXEL_SIZE    = { 5, 5 };
-    inline constexpr sdl::Color  DEFAULT_OFF_COLOR   = { 0x00, 0x00, 0x00, 0xff };
-    inline constexpr sdl::Color  DEFAULT_ON_COLOR    = { 0xff, 0xff, 0xff, 0xff };
+    inline constexpr Point LORES_DISPLAY_SIZE = { 64, 32 };
+    inline constexpr Point HIRES_DISPLAY_SIZE = { 128, 64 };
 
     enum class PixelState {
         OFF,
@@ -41,90 +34,77 @@ namespace nchip8 {
     };
 
     struct Sprite {
-        sdl::Point pos;
+        static constexpr std::size_t MAX_HEIGHT = 16;
 
-        std::vector<std::uint16_t> pixels;
+        // Must be inside the display
+        Point pos;
+
+        // Only the lower `width` bits of a row are drawn, the highest of them is the leftmost pixel
+        std::array<std::uint16_t, MAX_HEIGHT> rows;
+        int height;
         int width;
     };
 
+    struct SpriteCollision {
+        // Rows that turned off at least one pixel
+        int collidedRows = 0;
+        // Rows that weren't drawn because they're below the bottom edge (only without vertical wrapping)
+        int clippedRows = 0;
+    };
+
+    // The framebuffer of the VM. It knows nothing about how it's shown, see DisplaySink.
+    //
+    // The pixels are packed into 64-bit words, so clearing and scrolling work on whole words. Rows changed since the
+    // last presentation are tracked in a bit mask, so a sink can skip the rest.
     class Display {
     public:
-        Display(sdl::Renderer &renderer);
+        static constexpr std::size_t LINE_WORDS = HIRES_DISPLAY_SIZE.x / 64;
+
+        // Bit x % 64 of word x / 64 is the pixel in the column x
+        using Line = std::array<std::uint64_t, LINE_WORDS>;
+        // All lines of the framebuffer, the ones below the visible area (in lores) are zero
+        using Frame = std::array<Line, HIRES_DISPLAY_SIZE.y>;
+
+        static_assert(HIRES_DISPLAY_SIZE.y <= 64, "the dirty rows must fit into a 64-bit mask");
+
+        static bool pixel(const Line &line, std::size_t x) {
+            return line[x / 64] >> (x % 64) & 1;
+        }
+
+        Display();
 
-        void prepare();
-        void draw();
         void clear();
-        void setPixel(sdl::Point pos, PixelState state);
-        PixelState at(sdl::Point pos) const;
+        void setPixel(Point pos, PixelState state);
+        PixelState at(Point pos) const;
+        const Line &line(std::size_t y) const;
 
-        bool drawSprite(const Sprite &sprite);
+        SpriteCollision drawSprite(const Sprite &sprite);
         void scroll(ScrollDirection dir, int n);
 
         void setResolution(Resolution res);
-        void setScaleFactor(int factor);
-        void setOffColor(sdl::Color color);
-        void setOnColor(sdl::Color color);
-        void setFadeSpeed(double speed);
-        void enableGrid(bool enable);
-        void enableFade(bool enable);
-
-        sdl::Point size() const;
+
+        // Used by the save states
+        void copyTo(Frame &frame) const;
+        void restore(const Frame &frame, Resolution res);
+
+        // Bit y is set if the row y may have changed since the last clearDirtyRows()
+        std::uint64_t dirtyRows() const;
+        void clearDirtyRows();
+        void markAllRowsDirty();
+
+        Point size() const;
         Resolution res() const;
-        int scaleFactor() const;
-        sdl::Color offColor() const;
-        sdl::Color onColor() const;
-        bool gridEnabled() const;
-        bool fadeEnabled() const;
+        // FNV-1a of the visible pixels, row by row
+        std::uint64_t hash() const;
 
         bool wrapPixelsX = false;
         bool wrapPixelsY = false;
 
     private:
-        struct FadePixel {
-            FadePixel(sdl::Point pos, sdl::Color color, sdl::Color offColor);
-
-            sdl::Point pos;
-            sdl::Color color;
-            sdl::Color offColor;
-            double step = 7.0;
-
-            void fade(double speed);
-            bool faded() const;
-        };
-
-        struct Line {
-            Line() = default;
-
-            std::bitset<HIRES_DISPLAY_SIZE.x> data;
-
-            struct {
-                std::size_t begin;
-                std::size_t end;
-            } updatedRegion;
-        };
-
-        static constexpr sdl::Point TEXTURE_SIZE = HIRES_DISPLAY_SIZE * HIRES_PIXEL_SIZE;
-
-        void updateAllLines();
-        bool drawSpritePixel(sdl::Point pos);
-
-        std::deque<Line> m_lines;
-        std::unordered_set<std::size_t> m_updatedLines;
-        std::unordered_map<sdl::Point, FadePixel> m_fadePixels;
-        std::uint32_t m_lastlyFaded = 0;
-
-        sdl::Renderer &m_renderer;
-        sdl::Texture m_texture;
-        bool m_changed = false;
-
-        bool m_enableGrid  = false;
-        bool m_enableFade = false;
-        int  m_scaleFactor = 1;
-        double m_fadeSpeed = 5.0;
-        sdl::Color m_offColor = DEFAULT_OFF_COLOR;
-        sdl::Color m_onColor  = DEFAULT_ON_COLOR;
-        sdl::Point m_pixelSize;
-        sdl::Point m_size;
+        Frame m_lines {};
+        std::uint64_t m_dirtyRows = ~std::uint64_t(0);
+
+        Point m_size;
         Resolution m_res;
     };
 }
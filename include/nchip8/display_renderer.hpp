@@ -0,0 +1,115 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#pragma once
+
+#include "display.hpp"
+#include "sdl.hpp"
+#include "sinks.hpp"
+#include "triple_buffer.hpp"
+#include "types.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nchip8 {
+    inline constexpr Point LORES_PIXEL_SIZE  = { 10, 10 };
+    inline constexpr Point HIRES_PIXEL_SIZE  = { 5, 5 };
+    inline constexpr Color DEFAULT_OFF_COLOR = { 0x00, 0x00, 0x00, 0xff };
+    inline constexpr Color DEFAULT_ON_COLOR  = { 0xff, 0xff, 0xff, 0xff };
+
+    // Draws the VM display with SDL. prepare() converts the rows changed since the last call to RGBA and uploads them
+    // to a streaming texture of the native resolution, which draw() scales up with the nearest neighbour filtering.
+    //
+    // present() is called on the emulation thread (or by whoever holds the VM lock), everything else on the UI
+    // thread. The presented frames are passed between them through a triple buffer.
+    class DisplayRenderer : public DisplaySink {
+    public:
+        DisplayRenderer(sdl::Renderer &renderer);
+
+        void present(const Display &display) override;
+        // Whether a frame that looks different has been presented since the last call (or the afterglow is still
+        // fading). Called on the emulation thread, so the UI thread can sleep while there is nothing new to draw.
+        bool takeChanged();
+
+        void prepare();
+        void draw();
+
+        void setScaleFactor(int factor);
+        void setOffColor(Color color);
+        void setOnColor(Color color);
+        void setFadeSpeed(double speed);
+        void enableGrid(bool enable);
+        void enableFade(bool enable);
+
+        int scaleFactor() const;
+        Color offColor() const;
+        Color onColor() const;
+        bool gridEnabled() const;
+        bool fadeEnabled() const;
+
+    private:
+        static constexpr Point TEXTURE_SIZE = HIRES_DISPLAY_SIZE;
+        // Both resolutions take the same space
+        static constexpr Point GRID_SIZE = HIRES_DISPLAY_SIZE * HIRES_PIXEL_SIZE;
+
+        struct PresentedFrame {
+            Display::Frame lines;
+            Resolution res;
+            // Counts the presented frames, so the skipped ones are known
+            std::uint64_t number;
+        };
+
+        void takePresentedFrame();
+        void convertRow(std::size_t y);
+        void fadePixels(std::uint64_t frames);
+        void updateRamp();
+        void buildGrid();
+        void drawGridOutlines();
+
+        TripleBuffer<PresentedFrame> m_presented;
+        std::uint64_t m_presentedCount = 0;
+        Resolution m_presentedRes = Resolution::LOW;
+        bool m_changed = true;
+        std::uint64_t m_lastFrameNumber = 0;
+
+        // Copy of the last presented frame and the rows that must be converted and uploaded again
+        Display::Frame m_frame {};
+        std::uint64_t m_dirtyRows = ~std::uint64_t(0);
+
+        // RGBA8888, TEXTURE_SIZE.x pixels per row
+        std::array<std::uint32_t, TEXTURE_SIZE.x * TEXTURE_SIZE.y> m_pixels {};
+
+        // Outlines of the pixels that are on and off, reused between the frames. Only needed when the grid can't be
+        // drawn from the overlay.
+        std::vector<sdl::Rect> m_gridRects[2];
+
+        // Brightness of the afterglow of the pixels that are off, 255 right after a pixel is turned off. Laid out like
+        // m_pixels.
+        std::array<std::uint8_t, TEXTURE_SIZE.x * TEXTURE_SIZE.y> m_intensity {};
+        // RGBA8888 colors from the off color (intensity 0) to the on color (255)
+        std::array<std::uint32_t, 256> m_ramp {};
+        std::uint8_t m_fadeStep = 1;
+        // Set by the UI thread while any pixel glows
+        std::atomic<bool> m_glowing = false;
+
+        sdl::Renderer &m_renderer;
+        sdl::Texture m_texture;
+        // White outlines of all pixels, blended so they invert the colors under them
+        sdl::Texture m_grid;
+        bool m_gridBlendingSupported = false;
+        bool m_gridBuilt = false;
+
+        bool m_enableGrid  = false;
+        bool m_enableFade = false;
+        int  m_scaleFactor = 1;
+        Color m_offColor = DEFAULT_OFF_COLOR;
+        Color m_onColor  = DEFAULT_ON_COLOR;
+        Point m_pixelSize = LORES_PIXEL_SIZE;
+        Point m_size = LORES_DISPLAY_SIZE;
+        Resolution m_res = Resolution::LOW;
+    };
+}
@@ -0,0 +1,79 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#pragma once
+
+#include "triple_buffer.hpp"
+#include "vm.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace nchip8 {
+    // Runs the emulation on its own thread, TIMER_FREQ frames per second, so a slow UI frame doesn't slow it down.
+    //
+    // The VM is guarded by a mutex: the thread holds it while running a frame, and everything else that touches the
+    // VM must hold it too (see lock()), but only for as long as it touches it. The UI reads what it shows from the
+    // snapshot published after every frame instead, so it doesn't need the lock for that.
+    class EmulationThread {
+    public:
+        // Called once per frame, with the wall time at which the frame ends (see VM::runFrame(frameEnd)). The thread
+        // keeps the frame rate, so the function must emulate exactly one frame.
+        using Frame = std::function<void(std::chrono::steady_clock::time_point frameEnd)>;
+
+        // What the UI shows without locking the VM
+        struct Snapshot {
+            VMState state;
+            VMMode mode = VMMode::EMPTY;
+            bool recording = false;
+            bool playingBack = false;
+            std::chrono::nanoseconds runAheadTime { 0 };
+        };
+
+        // Holds the VM lock. The snapshot is published again when it's released, so the changes made meanwhile
+        // (e.g. loading a ROM) show up right away instead of after the next frame.
+        class Lock {
+        public:
+            explicit Lock(EmulationThread &thread);
+            ~Lock();
+
+            Lock(const Lock &) = delete;
+            Lock &operator=(const Lock &) = delete;
+
+        private:
+            EmulationThread &m_thread;
+            std::lock_guard<std::mutex> m_lock;
+        };
+
+        // Starts the thread right away. The frame function is called with the VM locked and must not throw.
+        EmulationThread(VM &vm, Frame frame);
+        ~EmulationThread();
+
+        EmulationThread(const EmulationThread &) = delete;
+        EmulationThread &operator=(const EmulationThread &) = delete;
+
+        Lock lock();
+
+        // The state after the last emulated frame or the last lock. Must be called only by one thread (the UI one),
+        // the reference is valid until the next call.
+        const Snapshot &snapshot();
+
+    private:
+        void run();
+        // Must be called with the VM locked
+        void publish();
+
+        VM &m_vm;
+        Frame m_frame;
+
+        std::mutex m_mutex;
+        // Published from both threads, but only with the VM locked, so there is still one producer at a time
+        TripleBuffer<Snapshot> m_snapshots;
+
+        std::atomic<bool> m_stop = false;
+        std::thread m_thread;
+    };
+}
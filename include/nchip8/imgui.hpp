@@ -15,7 +15,7 @@
 #include <string>
 
 namespace nchip8::imgui {
-    inline sdl::Color imVec4ToRGBA(ImVec4 color) {
+    inline Color imVec4ToRGBA(ImVec4 color) {
         // ImGui for some reason uses BGR for colors, so to convert our RGBA colors, we must reverse their byte order
         // (the same applies to rgbaToImVec4()).
         std::uint32_t abgr = ImGui::ColorConvertFloat4ToU32(color);
@@ -25,10 +25,10 @@ namespace nchip8::imgui {
         std::uint8_t b = (abgr & 0x00ff0000) >> 16;
         std::uint8_t a = (abgr & 0xff000000) >> 24;
 
-        return sdl::Color(r, g, b, a);
+        return { r, g, b, a };
     }
 
-    inline ImVec4 rgbaToImVec4(sdl::Color color) {
+    inline ImVec4 rgbaToImVec4(Color color) {
         std::uint32_t abgr = 0;
 
         abgr |= (std::uint32_t) color.r;
@@ -6,7 +6,10 @@
 #include "vm.hpp"
 
 namespace nchip8::instr_set_impls {
-#define DECL(_name) void _name##_impl(VM &vm, std::uint16_t opcode)
+#define DECL(_name) void _name##_impl(VM &vm, const OperandMap &ops)
+    // Handlers that depend on a quirk or on the extension take it as a template parameter, so they don't test it on
+    // every execution. The VM picks the specializations for the active quirks when it builds the dispatch table.
+
     // CHIP-8 instructions
     DECL(clearScreen);
     DECL(ret);
@@ -18,19 +21,19 @@ namespace nchip8::instr_set_impls {
     DECL(loadByte);
     DECL(add);
     DECL(loadReg);
-    DECL(or);
-    DECL(and);
-    DECL(xor);
+    template <bool ResetVF> DECL(or);
+    template <bool ResetVF> DECL(and);
+    template <bool ResetVF> DECL(xor);
     DECL(addReg);
     DECL(subReg);
-    DECL(rshift);
+    template <bool ShiftVY> DECL(rshift);
     DECL(loadAndSubReg);
-    DECL(lshift);
+    template <bool ShiftVY> DECL(lshift);
     DECL(skipRegsNotEqual);
     DECL(loadI);
-    DECL(jumpOffset);
+    template <bool UseV0> DECL(jumpOffset);
     DECL(random);
-    DECL(drawSprite);
+    template <Extension Ext, bool Draw8x16InLores, bool CountCollidedRows> DECL(drawSprite);
     DECL(skipPressed);
     DECL(skipNotPressed);
     DECL(loadDT);
@@ -40,8 +43,8 @@ namespace nchip8::instr_set_impls {
     DECL(addI);
     DECL(fontChar);
     DECL(bcd);
-    DECL(regDump);
-    DECL(regLoad);
+    template <bool IncrementI> DECL(regDump);
+    template <bool IncrementI> DECL(regLoad);
 
     // SCHIP instructions
     DECL(hires);
@@ -53,5 +56,8 @@ namespace nchip8::instr_set_impls {
     DECL(saveFlags);
     DECL(loadFlags);
     DECL(exit);
+
+    // Stands for every opcode that can't be decoded, throws InvalidOpcode
+    DECL(invalidOpcode);
 #undef DECL
 }
@@ -3,8 +3,8 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
-#include <functional>
 #include <string>
 
 namespace nchip8 {
@@ -57,11 +57,16 @@ namespace nchip8 {
         EXIT
     };
 
+    inline constexpr std::size_t INSTR_KIND_COUNT = (std::size_t) InstrKind::EXIT + 1;
+
     std::string instrKindToString(InstrKind kind);
 
     struct OperandMap {
+        OperandMap() = default;
         OperandMap(std::uint16_t opcode);
 
+        std::uint16_t opcode;
+
         // Symbols:
         //   X - first register
         //   Y - second register
@@ -89,7 +94,8 @@ namespace nchip8 {
     class VM;
     class Instruction {
     public:
-        using Impl = std::function<void(VM &, std::uint16_t)>;
+        // Plain function pointer: the VM calls it once per executed instruction, so it must be cheap to invoke
+        using Impl = void (*)(VM &, const OperandMap &);
 
         Instruction(InstrKind kind, Impl impl);
 
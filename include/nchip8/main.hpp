@@ -2,12 +2,19 @@
 // This file is distributed under the MIT license (https://opensource.org/license/mit/)
 
 #include "application.hpp"
+#include "audio_output.hpp"
 #include "config.hpp"
-#include "display.hpp"
+#include "display_renderer.hpp"
+#include "emulation_thread.hpp"
+#include "netplay.hpp"
 #include "sdl.hpp"
 #include "ui/ui.hpp"
 #include "vm.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
 #include <string>
 
 namespace nchip8 {
@@ -21,14 +28,47 @@ namespace nchip8 {
         void render() override;
         void deinit() override;
 
+        // Loads the ROM and plays it with the nCHIP-8 on the other end of the socket (see NetplaySession)
+        void startNetplay(const std::string &rom, const std::string &localSocket, const std::string &remoteSocket);
+
     private:
+        using Clock = std::chrono::steady_clock;
+
+        // How long the loop keeps polling after the last input, as ImGui keeps animating for a while (e.g. the
+        // tooltips appear after a delay)
+        static constexpr auto BUSY_TIME = std::chrono::milliseconds(500);
+        // When idle, the loop wakes up at least this often, so the CPU usage in the About window stays current
+        static constexpr int IDLE_TIMEOUT_MS = 1000;
+
         Config readConfig();
+        void handleKey(const SDL_KeyboardEvent &event);
+        // Called on the emulation thread with the VM locked, once per frame
+        void emulateFrame(std::chrono::steady_clock::time_point frameEnd);
+        // Wakes the UI thread up from waiting for events. Can be called from any thread.
+        void wakeUp();
+        void limitFrameRate();
 
         Config m_cfg;
         sdl::Window m_window;
         sdl::Renderer m_renderer;
-        Display m_display;
+        DisplayRenderer m_displayRenderer;
+        AudioOutput m_audioOutput;
         VM m_vm;
         ui::UI m_ui;
+        std::unique_ptr<NetplaySession> m_netplay;
+        std::atomic<bool> m_rewindHeld = false;
+        // Rebuilt when the layout is changed in the settings
+        InputLayout m_keyMapLayout {};
+        KeyMap m_keyMap {};
+
+        // Pushed by wakeUp(); pending until the UI thread takes it, so the queue isn't flooded when the UI is slow
+        std::uint32_t m_wakeEvent = SDL_RegisterEvents(1);
+        std::atomic<bool> m_wakePending = false;
+        Clock::time_point m_busyUntil = Clock::now() + BUSY_TIME;
+        Clock::time_point m_lastFrame = Clock::now();
+        bool m_vsync = false;
+
+        // Last, so the thread is stopped before anything it uses is destroyed
+        EmulationThread m_emulation;
     };
 }
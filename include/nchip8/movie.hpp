@@ -0,0 +1,51 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#pragma once
+
+#include "vm.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace nchip8 {
+    class MovieError : public VMError {
+    public:
+        MovieError(const std::string &err);
+    };
+
+    // A change of a key, made before the instruction with the given number (counted from the start of the movie)
+    struct InputEvent {
+        std::uint64_t cycle;
+        std::uint8_t key;
+        bool pressed;
+    };
+
+    // A recording of all key changes since a reset of the VM, along with everything else that affects the
+    // emulation. Since the input is keyed to the executed instructions instead of the wall time, a replay reproduces
+    // the run exactly, at whatever speed. See VM::startRecording() and VM::startPlayback().
+    struct Movie {
+        static constexpr std::uint32_t MAGIC   = 0x4d384843; // "CH8M" in little-endian
+        static constexpr std::uint32_t VERSION = 1;
+
+        Movie() = default;
+        // Throws MovieError if the file cannot be read or isn't a movie
+        explicit Movie(const std::string &path);
+
+        void writeFile(const std::string &path) const;
+
+        std::uint64_t romHash = 0;
+        Extension ext = Extension::NONE;
+        Quirks quirks;
+        unsigned rngSeed = 0;
+        unsigned cyclesPerSec = 0;
+        std::uint64_t rplFlags = 0;
+
+        // Filled when the recording is stopped, so a replay can check it ended up in the same state
+        std::uint64_t frameCount = 0;
+        std::uint64_t finalDisplayHash = 0;
+
+        std::vector<InputEvent> events;
+    };
+}
@@ -0,0 +1,111 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#pragma once
+
+#include "vm.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace nchip8 {
+    class NetplayError : public VMError {
+    public:
+        NetplayError(const std::string &err);
+    };
+
+    // A two-player session over a local (Unix domain) socket. Both players run the same ROM in their own VM and
+    // share one keypad: a key is pressed if either of them holds it.
+    //
+    // Every frame, the local keys are sent to the other side. Waiting for its keys would add a round trip of lag,
+    // so they are predicted instead (assumed to be the same as the last known ones). When the real keys arrive and
+    // differ from the prediction, the VM is rolled back to the save state of that frame and the frames since then
+    // are emulated again.
+    class NetplaySession {
+    public:
+        // How far the session may get ahead of the other side before it waits for it
+        static constexpr std::uint64_t MAX_ROLLBACK_FRAMES = 8;
+
+        // Binds the socket to localPath, the other side is expected at remotePath. Restarts the loaded ROM with a
+        // PRNG seed derived from it (instead of the one from the config, until the session ends), so both sides start
+        // in the same state. Throws NetplayError.
+        NetplaySession(VM &vm, const std::string &localPath, const std::string &remotePath);
+        ~NetplaySession();
+
+        NetplaySession(const NetplaySession &) = delete;
+        NetplaySession &operator=(const NetplaySession &) = delete;
+
+        // Runs all frames that are due since the last call, according to the wall clock (the replacement of
+        // VM::update())
+        void update();
+        // Emulates the next frame and presents it. Returns false if the session is too far ahead of the other side
+        // and must wait for it.
+        bool runFrame();
+        // The key of the local player
+        void setKey(std::size_t key, bool pressed);
+
+        // Number of emulated frames
+        std::uint64_t frame() const;
+        // Number of frames for which the keys of the other side are known
+        std::uint64_t confirmedFrame() const;
+        std::uint64_t rollbackCount() const;
+        std::uint64_t resimulatedFrames() const;
+
+    private:
+        // Inputs and save states kept per frame. Must cover MAX_ROLLBACK_FRAMES on both sides of the current frame,
+        // as the other side may be ahead too.
+        static constexpr std::size_t HISTORY_SIZE = 32;
+
+        static_assert(HISTORY_SIZE > 2 * MAX_ROLLBACK_FRAMES);
+
+        // Sent every frame. It carries all local keys not yet acknowledged, so lost packets don't matter.
+        struct Packet {
+            std::uint32_t magic;
+            // Identifies the ROM and the settings, both sides must have the same ones
+            std::uint64_t sessionHash;
+            // Number of frames for which the sender knows the keys of the receiver
+            std::uint64_t ack;
+            std::uint64_t firstFrame;
+            std::uint32_t keyCount;
+            std::array<std::uint16_t, HISTORY_SIZE> keys;
+        };
+
+        // Returns the first frame emulated with a wrong prediction, or m_frame if there is none
+        std::uint64_t receive();
+        void send();
+        void rollback(std::uint64_t from);
+        void simulate(std::uint64_t frame);
+        std::uint16_t remoteKeys(std::uint64_t frame) const;
+
+        using Clock = std::chrono::steady_clock;
+
+        VM &m_vm;
+        int m_socket = -1;
+        std::string m_localPath;
+        std::string m_remotePath;
+        std::uint64_t m_sessionHash = 0;
+
+        std::uint16_t m_localKeys = 0;
+        // Indexed by the frame modulo HISTORY_SIZE. The saves are the states at the beginning of the frames.
+        std::vector<SaveState> m_saves;
+        std::array<std::uint16_t, HISTORY_SIZE> m_localInputs {};
+        std::array<std::uint16_t, HISTORY_SIZE> m_remoteInputs {};
+        // What the frames were actually emulated with, to detect wrong predictions
+        std::array<std::uint16_t, HISTORY_SIZE> m_usedRemoteInputs {};
+
+        std::uint64_t m_frame = 0;
+        std::uint64_t m_remoteConfirmed = 0;
+        std::uint64_t m_localAcked = 0;
+
+        std::uint64_t m_rollbackCount = 0;
+        std::uint64_t m_resimulatedFrames = 0;
+
+        Clock::time_point m_lastUpdate = Clock::now();
+        // In the same units as VM::m_pendingTime
+        std::int64_t m_pendingTime = 0;
+    };
+}
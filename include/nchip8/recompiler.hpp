@@ -0,0 +1,96 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#pragma once
+
+#include "instruction.hpp"
+#include "vm.hpp"
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__unix__)
+# define NCHIP8_RECOMPILER_SUPPORTED 1
+#else
+# define NCHIP8_RECOMPILER_SUPPORTED 0
+#endif
+
+namespace nchip8 {
+    // Translates hot basic blocks of CHIP-8/SCHIP code into native x86-64 code.
+    //
+    // A block is a straight run of instructions that neither transfer control, nor write to the memory, nor draw,
+    // nor wait for a key, nor may throw. The instruction that ends a block (jump, skip, call, draw, key wait...) is
+    // left to the interpreter. On other architectures the recompiler never compiles anything, so the VM always
+    // interprets.
+    class Recompiler {
+    public:
+        Recompiler(VM &vm);
+        ~Recompiler();
+
+        Recompiler(const Recompiler &) = delete;
+        Recompiler &operator=(const Recompiler &) = delete;
+
+        static bool supported();
+
+        // Executes the block beginning at addr, if it's compiled (or hot enough to be compiled now) and has no more
+        // than maxCycles instructions. Returns the number of executed instructions, 0 means that the caller must
+        // interpret the instruction at addr.
+        std::size_t run(std::uint16_t addr, std::size_t maxCycles);
+
+        // Drops the compiled code if the range overlaps any block
+        void invalidate(std::uint16_t addr, std::size_t size);
+        // Drops all compiled code (e.g. when the quirks have changed, as they are baked into the code)
+        void flush();
+
+    private:
+        using Code = void (*)(VM *);
+
+        struct Block {
+            Code code = nullptr;
+            std::uint16_t length = 0; // in instructions
+            std::uint16_t hits = 0;
+            bool uncompilable = false;
+        };
+
+        // How many times a block must be entered before it's compiled
+        static constexpr std::uint16_t HOT_THRESHOLD = 8;
+        static constexpr std::size_t MIN_BLOCK_LENGTH = 2;
+        static constexpr std::size_t MAX_BLOCK_LENGTH = 256;
+        static constexpr std::size_t CODE_BUFFER_SIZE = 1024 * 1024;
+
+        bool compile(std::uint16_t addr, Block &block);
+        bool emitInstr(std::uint16_t opcode);
+
+        void emit(std::initializer_list<std::uint8_t> bytes);
+        void emitU16(std::uint16_t value);
+        void emitI32(std::int32_t value);
+        void emitU64(std::uint64_t value);
+        // Emits [rbx + disp32] as the memory operand (ModRM with the given reg field)
+        void emitMem(std::uint8_t reg, std::int32_t disp);
+        void emitCall(Instruction::Impl impl, const OperandMap &ops);
+
+        std::int32_t regDisp(std::size_t reg) const;
+
+        VM &m_vm;
+        std::array<Block, MEM_SIZE> m_blocks;
+        std::bitset<MEM_SIZE> m_covered; // bytes of memory occupied by the compiled blocks
+
+        // Operands of the instructions compiled as calls to the interpreter handlers. Deque doesn't move its
+        // elements on growth, so the code can refer to them directly.
+        std::deque<OperandMap> m_calloutOps;
+
+        std::uint8_t *m_code = nullptr;
+        std::size_t m_codeSize = 0;
+        std::vector<std::uint8_t> m_buf; // block being emitted
+
+        std::int32_t m_regsDisp = 0;
+        std::int32_t m_iDisp = 0;
+        std::int32_t m_dtDisp = 0;
+        std::int32_t m_stDisp = 0;
+    };
+}
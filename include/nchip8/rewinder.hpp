@@ -0,0 +1,65 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#pragma once
+
+#include "vm.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <vector>
+
+namespace nchip8 {
+    // Keeps a history of save states, one per frame, so the VM can be run backwards.
+    //
+    // Every KEYFRAME_INTERVAL-th save state (a keyframe) is stored as is. The other ones are XORed with the keyframe
+    // before them and the result is run-length encoded: a frame usually changes just the registers, a few bytes of
+    // memory and some pixels, so a delta takes tens of bytes instead of kilobytes. Any save state is decoded from its
+    // keyframe and its own delta only. When the history exceeds the limits given in CPUConfig, the oldest keyframe
+    // is dropped along with its deltas.
+    class Rewinder {
+    public:
+        static constexpr std::size_t KEYFRAME_INTERVAL = 60;
+
+        Rewinder(const CPUConfig &cfg);
+
+        // Appends the current state of the VM
+        void capture(const VM &vm);
+        // Restores the save state of the previous frame and removes it from the history. Returns false if the history
+        // is empty.
+        bool rewind(VM &vm);
+        void clear();
+
+        std::size_t frameCount() const;
+        std::size_t memoryUsage() const;
+
+    private:
+        using Delta = std::vector<std::uint8_t>;
+
+        struct Group {
+            SaveState keyframe;
+            std::vector<Delta> deltas;
+        };
+
+        void encode(const SaveState &save, const SaveState &keyframe, Delta &delta) const;
+        void decode(const Delta &delta, const SaveState &keyframe, SaveState &save) const;
+        void trim();
+        void dropNewest();
+        void recycle(Delta &&delta);
+
+        const CPUConfig &m_cfg;
+
+        std::deque<Group> m_groups;
+        // Buffers of the removed deltas, reused so the capturing doesn't allocate most of the time
+        std::vector<Delta> m_freeDeltas;
+        SaveState m_scratch;
+
+        std::size_t m_frameCount = 0;
+        std::size_t m_memoryUsage = 0;
+        // VM::cycleCount() at the last capture, until a rewind. If the VM is still there, the newest save state is
+        // the current state, so rewinding to it wouldn't go back at all.
+        std::optional<std::uint64_t> m_newestCycle;
+    };
+}
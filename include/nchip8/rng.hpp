@@ -0,0 +1,47 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#pragma once
+
+#include <cstdint>
+
+namespace nchip8 {
+    // PCG32 (XSH-RR variant, see https://www.pcg-random.org/). It's small (16 bytes), fast, and it's a plain value,
+    // so it's saved and restored along with the rest of VMState. The generated sequence depends only on the seed.
+    class Rng {
+    public:
+        void seed(std::uint64_t seed, std::uint64_t stream = DEFAULT_STREAM);
+        // Skips the next n numbers in O(log n) steps
+        void advance(std::uint64_t n);
+
+        std::uint32_t next() {
+            std::uint64_t old = m_state;
+            m_state = old * MULTIPLIER + m_increment;
+
+            auto xorShifted = (std::uint32_t) (((old >> 18u) ^ old) >> 27u);
+            auto rot = (std::uint32_t) (old >> 59u);
+
+            return (xorShifted >> rot) | (xorShifted << ((-rot) & 31));
+        }
+
+        std::uint32_t operator()() {
+            return next();
+        }
+
+        // The whole internal state, for the save state files
+        std::uint64_t state() const;
+        std::uint64_t increment() const;
+        // The increment must be odd, the lowest bit is forced
+        void restore(std::uint64_t state, std::uint64_t increment);
+
+        bool operator==(const Rng &other) const;
+        bool operator!=(const Rng &other) const;
+
+    private:
+        static constexpr std::uint64_t MULTIPLIER = 6364136223846793005ull;
+        static constexpr std::uint64_t DEFAULT_STREAM = 0xda3e39cb94b95bdbull;
+
+        std::uint64_t m_state = 0x853c49e6748fea9bull;
+        std::uint64_t m_increment = DEFAULT_STREAM;
+    };
+}
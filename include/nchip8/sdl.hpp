@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include "types.hpp"
+
 #include <SDL.h>
 
 #ifdef __clang__
@@ -24,3 +26,13 @@
 #endif
 
 namespace sdl = SDL2pp;
+
+namespace nchip8 {
+    inline sdl::Point toSDL(Point point) {
+        return { point.x, point.y };
+    }
+
+    inline sdl::Color toSDL(Color color) {
+        return { color.r, color.g, color.b, color.a };
+    }
+}
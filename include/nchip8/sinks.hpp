@@ -0,0 +1,25 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#pragma once
+
+#include "display.hpp"
+
+namespace nchip8 {
+    // Receives the framebuffer once per emulated frame (and after a reset). A headless VM has no sink at all.
+    class DisplaySink {
+    public:
+        virtual ~DisplaySink() = default;
+
+        virtual void present(const Display &display) = 0;
+    };
+
+    // Told after every emulated frame whether the tone sounds during it, so the tone starts and stops at the exact
+    // frame. The frames emulated again (run-ahead, netplay rollbacks) aren't reported.
+    class AudioSink {
+    public:
+        virtual ~AudioSink() = default;
+
+        virtual void frame(bool toneOn) = 0;
+    };
+}
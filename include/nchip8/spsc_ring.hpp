@@ -0,0 +1,61 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace nchip8 {
+    // A bounded queue between one producer thread and one consumer thread, without locks. push() is called only by
+    // the producer, the rest only by the consumer.
+    template <typename T, std::size_t Capacity>
+    class SpscRing {
+        static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "the capacity must be a power of two");
+
+    public:
+        // Returns false if the ring is full
+        bool push(const T &value) {
+            std::size_t head = m_head.load(std::memory_order_relaxed);
+
+            if (head - m_tail.load(std::memory_order_acquire) == Capacity) {
+                return false;
+            }
+
+            m_items[head % Capacity] = value;
+            m_head.store(head + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        // Copies the oldest value without removing it, returns false if the ring is empty
+        bool peek(T &value) const {
+            std::size_t tail = m_tail.load(std::memory_order_relaxed);
+
+            if (tail == m_head.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            value = m_items[tail % Capacity];
+
+            return true;
+        }
+
+        // Must follow a successful peek()
+        void pop() {
+            m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        std::size_t size() const {
+            return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::array<T, Capacity> m_items {};
+
+        // Kept on separate cache lines, as each is written by a different thread
+        alignas(64) std::atomic<std::size_t> m_head { 0 };
+        alignas(64) std::atomic<std::size_t> m_tail { 0 };
+    };
+}
@@ -0,0 +1,59 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace nchip8 {
+    // A work-stealing thread pool. Every worker has its own queue of tasks: it takes the tasks from its back, and
+    // when it runs out of them, it steals from the front of the other queues. So the workers that got short tasks
+    // help the ones that got long tasks instead of waiting.
+    class ThreadPool {
+    public:
+        using Task = std::function<void()>;
+
+        // 0 means one worker per hardware thread
+        explicit ThreadPool(std::size_t workerCount = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        // The task must not throw
+        void submit(Task task);
+        // Blocks until all submitted tasks are finished
+        void wait();
+
+        std::size_t workerCount() const;
+
+    private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        void work(std::size_t index);
+        bool tryPop(std::size_t index, Task &task);
+        bool trySteal(std::size_t thief, Task &task);
+
+        std::vector<std::unique_ptr<Queue>> m_queues;
+        std::vector<std::thread> m_workers;
+        std::size_t m_nextQueue = 0;
+
+        // The counters are guarded by m_mutex. m_queued is the number of queued tasks not yet claimed by a worker.
+        std::mutex m_mutex;
+        std::condition_variable m_workAvailable;
+        std::condition_variable m_allDone;
+        std::size_t m_queued = 0;
+        std::size_t m_unfinished = 0;
+        bool m_stop = false;
+    };
+}
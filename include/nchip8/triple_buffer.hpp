@@ -0,0 +1,51 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#pragma once
+
+#include <array>
+#include <atomic>
+
+namespace nchip8 {
+    // Hands values from one producer thread to one consumer thread without locks. The producer fills back() and
+    // publishes it, the consumer picks the latest published value with update() and reads it from front(). Neither
+    // side ever waits for the other: values published faster than the consumer updates are skipped.
+    template <typename T>
+    class TripleBuffer {
+    public:
+        // Producer side
+        T &back() {
+            return m_slots[m_back];
+        }
+
+        void publish() {
+            m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+        }
+
+        // Consumer side. Returns false if nothing has been published since the last call.
+        bool update() {
+            if (!(m_middle.load(std::memory_order_relaxed) & FRESH)) {
+                return false;
+            }
+
+            m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & INDEX_MASK;
+
+            return true;
+        }
+
+        const T &front() const {
+            return m_slots[m_front];
+        }
+
+    private:
+        // The middle slot index is kept together with the flag telling whether it's newer than the front one
+        static constexpr unsigned INDEX_MASK = 0x3;
+        static constexpr unsigned FRESH      = 0x4;
+
+        std::array<T, 3> m_slots {};
+
+        unsigned m_back  = 0;
+        std::atomic<unsigned> m_middle { 1 };
+        unsigned m_front = 2;
+    };
+}
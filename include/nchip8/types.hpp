@@ -0,0 +1,45 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#pragma once
+
+#include <cstdint>
+
+// Plain geometry and color types used by the core, so it doesn't depend on SDL
+namespace nchip8 {
+    struct Point {
+        int x = 0;
+        int y = 0;
+    };
+
+    constexpr inline Point operator*(Point a, Point b) {
+        return { a.x * b.x, a.y * b.y };
+    }
+
+    constexpr inline Point operator*(Point a, int factor) {
+        return { a.x * factor, a.y * factor };
+    }
+
+    constexpr inline bool operator==(Point a, Point b) {
+        return a.x == b.x && a.y == b.y;
+    }
+
+    constexpr inline bool operator!=(Point a, Point b) {
+        return !(a == b);
+    }
+
+    struct Color {
+        std::uint8_t r = 0x00;
+        std::uint8_t g = 0x00;
+        std::uint8_t b = 0x00;
+        std::uint8_t a = 0xff;
+    };
+
+    constexpr inline bool operator==(Color a, Color b) {
+        return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+    }
+
+    constexpr inline bool operator!=(Color a, Color b) {
+        return !(a == b);
+    }
+}
@@ -5,12 +5,14 @@
 
 #include "window.hpp"
 #include "../breakpoint.hpp"
+#include "../emulation_thread.hpp"
 #include "../imgui.hpp"
 
 namespace nchip8::ui {
     class Breakpoints : public Window {
     public:
-        Breakpoints(BreakpointMap &bps);
+        // Only the changes of the breakpoints lock the VM: the emulation never changes them, it just reads them
+        Breakpoints(BreakpointMap &bps, EmulationThread &emulation);
 
     private:
         void body() override;
@@ -20,6 +22,7 @@ namespace nchip8::ui {
         inline bool containsOnlyWhitespaces(const std::string_view &str) const;
 
         BreakpointMap &m_bps;
+        EmulationThread &m_emulation;
         Breakpoint m_editableBp;
 
         // See https://github.com/ocornut/imgui/issues/331
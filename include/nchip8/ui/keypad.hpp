@@ -4,16 +4,20 @@
 #pragma once
 
 #include "window.hpp"
+#include "../config.hpp"
+#include "../emulation_thread.hpp"
 #include "../vm.hpp"
 
 namespace nchip8::ui {
     class Keypad : public Window {
     public:
-        Keypad(VM &vm);
+        Keypad(const Config &cfg, VM &vm, EmulationThread &emulation);
 
     private:
         void body() override;
 
+        const Config &m_cfg;
         VM &m_vm;
+        EmulationThread &m_emulation;
     };
 }
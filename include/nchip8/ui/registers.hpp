@@ -4,16 +4,18 @@
 #pragma once
 
 #include "window.hpp"
+#include "../emulation_thread.hpp"
 #include "../vm.hpp"
 
 namespace nchip8::ui {
     class Registers : public Window {
     public:
-        Registers(VM &vm);
+        Registers(VM &vm, EmulationThread &emulation);
 
     private:
         void body() override;
 
         VM &m_vm;
+        EmulationThread &m_emulation;
     };
 }
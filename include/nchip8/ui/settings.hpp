@@ -4,7 +4,10 @@
 #pragma once
 
 #include "window.hpp"
+#include "../audio_output.hpp"
 #include "../config.hpp"
+#include "../display_renderer.hpp"
+#include "../emulation_thread.hpp"
 #include "../imgui.hpp"
 #include "../vm.hpp"
 
@@ -12,7 +15,12 @@ namespace nchip8::ui {
     class UI;
     class Settings : public Window {
     public:
-        Settings(sdl::Window &window, VM &vm, UI &ui);
+        Settings(sdl::Window &window, Config &cfg, VM &vm, EmulationThread &emulation, DisplayRenderer &displayRenderer,
+                 AudioOutput &audioOutput, UI &ui);
+
+        // Must be called when the quirks are changed outside of the settings (e.g. by loading a save state), with
+        // the VM locked
+        void reloadQuirks();
 
     private:
         void body() override;
@@ -28,7 +36,11 @@ namespace nchip8::ui {
         void marker(const std::string &text);
 
         sdl::Window &m_window;
+        Config &m_cfg;
         VM     &m_vm;
+        EmulationThread &m_emulation;
+        DisplayRenderer &m_displayRenderer;
+        AudioOutput &m_audioOutput;
         UI     &m_ui;
         Config  m_newCfg;
         Quirks  m_quirks;
@@ -4,16 +4,16 @@
 #pragma once
 
 #include "window.hpp"
-#include "../vm.hpp"
+#include "../emulation_thread.hpp"
 
 namespace nchip8::ui {
     class Stack : public Window {
     public:
-        Stack(VM &vm);
+        Stack(EmulationThread &emulation);
 
     private:
         void body() override;
 
-        VM &m_vm;
+        EmulationThread &m_emulation;
     };
 }
@@ -11,24 +11,43 @@
 #include "settings.hpp"
 #include "stack.hpp"
 #include "ui_style.hpp"
+#include "../audio_output.hpp"
+#include "../config.hpp"
+#include "../display_renderer.hpp"
+#include "../emulation_thread.hpp"
 #include "../imgui.hpp"
+#include "../movie.hpp"
 #include "../sdl.hpp"
 #include "../vm.hpp"
 
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <optional>
 #include <string>
 
 namespace nchip8::ui {
+    inline constexpr std::size_t QUICK_SLOT_COUNT = 4;
+
     class UI {
     public:
-        UI(sdl::Window &window, sdl::Renderer &renderer, VM &vm);
+        UI(sdl::Window &window, sdl::Renderer &renderer, Config &cfg, VM &vm, DisplayRenderer &displayRenderer,
+           AudioOutput &audioOutput, EmulationThread &emulation);
         ~UI();
 
         void update();
+        // Can be called from any thread
         void showError(const std::string &err);
         void render();
         void setStyle(UIStyle style);
         bool wantCaptureKeyboard() const;
         bool quitRequested() const;
+        // Whether the shown state changes with every emulated frame (the debug windows are open). Must be called
+        // with the VM locked.
+        bool followsEmulation() const;
 
     private:
         void input();
@@ -42,12 +61,37 @@ namespace nchip8::ui {
 
         void windows();
 
+        // These lock the VM themselves
+        void step();
+        void quickSave(std::size_t slot);
+        void quickLoad(std::size_t slot);
+
+        void movieDialogs();
+        void saveStateDialogs();
+
         ImGuiIO *m_io;
+        Config &m_cfg;
         VM &m_vm;
+        EmulationThread &m_emulation;
+        // Guards m_currentError and m_openErrorPopup, as showError() is called from the emulation thread too
+        std::mutex m_errorMutex;
         std::string m_currentError;
+        // The error in the popup, only used by the UI thread
+        std::string m_shownError;
+        // Kept only in memory, for the current session
+        std::array<std::optional<SaveState>, QUICK_SLOT_COUNT> m_quickSlots;
+        // The movie being recorded or played back
+        Movie m_movie;
+        // As of the previous update()
+        bool m_playingBack = false;
 
         bool m_quitRequested = false;
 
+        // CPU usage of the whole process (all threads), sampled about once a second for the About window
+        double m_cpuUsage = 0;
+        std::chrono::steady_clock::time_point m_cpuSampleTime {};
+        std::clock_t m_cpuSampleUsed = 0;
+
         // Windows
         bool m_showMainMenu = false;
         bool m_showAbout = false;
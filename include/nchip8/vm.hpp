@@ -5,18 +5,23 @@
 
 
 #include "breakpoint.hpp"
-#include "config.hpp"
+#include "cpu_config.hpp"
 #include "display.hpp"
 #include "instruction.hpp"
-#include "sdl.hpp"
-#include "waveform_generator.hpp"
+#include "rng.hpp"
+#include "sinks.hpp"
+#include "spsc_ring.hpp"
+#include "types.hpp"
 
 #include <array>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
-#include <stack>
+#include <memory>
+#include <optional>
 #include <stdexcept>
-#include <unordered_map>
+#include <string>
+#include <type_traits>
 #include <vector>
 
 namespace nchip8 {
@@ -35,45 +40,80 @@ namespace nchip8 {
         StackOverflow();
     };
 
-    template<typename T, typename Container = std::vector<T>>
-    class VMStack : public std::stack<T, Container> {
+    class StackUnderflow : public VMError {
     public:
-        // Expose the member c, because we'll need it to print the data
-        // (see Stack View in src/ui.cpp).
-        using std::stack<T, Container>::c;
+        StackUnderflow();
     };
 
     inline constexpr std::size_t   MEM_SIZE       = 4096;
     inline constexpr std::uint16_t PROG_OFFSET    = 0x0200;
     inline constexpr std::size_t   PROG_MAX_SIZE  = MEM_SIZE - PROG_OFFSET;
     inline constexpr std::uint16_t FONT_OFFSET    = 0x0;
-    inline constexpr sdl::Point    FONT_CHAR_SIZE = { 4, 5 };
+    inline constexpr Point         FONT_CHAR_SIZE = { 4, 5 };
     inline constexpr std::size_t   FONT_MEM_SIZE  = FONT_CHAR_SIZE.y * 16;
     inline constexpr std::uint16_t BIG_FONT_OFFSET    = FONT_MEM_SIZE;
-    inline constexpr sdl::Point    BIG_FONT_CHAR_SIZE = { 8, 10 };
+    inline constexpr Point         BIG_FONT_CHAR_SIZE = { 8, 10 };
     inline constexpr std::size_t   BIG_FONT_MEM_SIZE  = BIG_FONT_CHAR_SIZE.y * 16;
+    // Both fonts come first, everything after them is the program memory
+    inline constexpr std::size_t   FONTS_END          = BIG_FONT_OFFSET + BIG_FONT_MEM_SIZE;
     inline constexpr std::size_t   STACK_MAX_SIZE  = 16;
-    inline constexpr int TIMER_UPDATE_FREQ = 1000 / 60;
+    inline constexpr int KEY_COUNT = 16;
+    inline constexpr unsigned TIMER_FREQ = 60; // Hz, the timers are decremented once per frame
+    inline constexpr std::size_t OPCODE_COUNT = 0x10000;
 
+    // Maps every possible opcode directly to its handler (unknown opcodes are mapped to a handler that throws
+    // InvalidOpcode), so the dispatch costs just one indexed load.
+    using DispatchTable = std::array<Instruction::Impl, OPCODE_COUNT>;
+
+    // An instruction at some memory address, decoded ahead of its execution
+    struct DecodedInstr {
+        Instruction::Impl impl = nullptr; // nullptr if the instruction must be decoded (again)
+        OperandMap ops {};
+    };
+
+    // One entry per byte of memory, as an instruction may begin at an odd address as well
+    using DecodeCache = std::array<DecodedInstr, MEM_SIZE>;
+
+    // The whole state of the CPU and the memory. It's a plain trivially copyable structure without any pointers, so
+    // it can be copied with a single memcpy (snapshots, handing it over to another thread, etc.).
     struct VMState {
         VMState();
 
         void updateTimers();
         void reset();
 
+        bool keyPressed(std::size_t key) const {
+            return key < KEY_COUNT && (keys >> key & 1);
+        }
+
+        void setKey(std::size_t key, bool pressed) {
+            keys = (std::uint16_t) (pressed ? keys | 1u << key : keys & ~(1u << key));
+        }
+
+        // The registers are grouped ahead of the memory, so the ones used by almost every instruction share a cache
+        // line
+        std::array<std::uint8_t, 16> regs;
         std::uint16_t pc; // program (instruction) counter
+        std::uint16_t  i; // address register
         std::uint8_t  dt; // delay timer
         std::uint8_t  st; // sound timer
-        std::uint16_t  i; // address register
-        std::array<std::uint8_t, 16> regs;
-        VMStack<std::uint16_t> stack;
+        std::uint8_t  sp; // number of the addresses in the stack
+        std::uint16_t keys; // bit N is set if the key N is pressed
+        std::array<std::uint16_t, STACK_MAX_SIZE> stack;
 
-        std::array<std::uint8_t, MEM_SIZE> memory;
-        std::size_t romSize;
+        // Used by CXNN, seeded from CPUConfig::rngSeed on every reset of the VM
+        Rng rng;
+        // The RPL user flags of FX75 and FX85 (SCHIP). Like the flags of the HP-48 they come from, they survive the
+        // resets. Start as CPUConfig::rplFlags.
+        std::uint64_t rplFlags;
 
-        std::bitset<KEY_COUNT> inputTable;
+        std::uint16_t romSize;
+        std::array<std::uint8_t, MEM_SIZE> memory;
     };
 
+    static_assert(std::is_trivially_copyable_v<VMState> && std::is_standard_layout_v<VMState>);
+    static_assert(KEY_COUNT <= 16, "VMState::keys must have a bit for every key");
+
     enum class VMMode {
         EMPTY,
         RUN,
@@ -91,30 +131,169 @@ namespace nchip8 {
 
         // SCHIP/XO-CHIP only
         bool draw8x16SpriteInLores = false;
+        // In hires, DXYN sets VF to the number of the rows that collided or were clipped at the bottom
+        bool collisionCountRows = false;
     };
 
+    inline bool operator==(const Quirks &a, const Quirks &b) {
+        return a.jumpOffsetUseV0 == b.jumpOffsetUseV0 && a.wrapPixelsX == b.wrapPixelsX &&
+               a.wrapPixelsY == b.wrapPixelsY && a.bitwiseResetVF == b.bitwiseResetVF &&
+               a.shiftSetVxToVy == b.shiftSetVxToVy && a.loadSaveIncrementI == b.loadSaveIncrementI &&
+               a.draw8x16SpriteInLores == b.draw8x16SpriteInLores && a.collisionCountRows == b.collisionCountRows;
+    }
+
+    inline bool operator!=(const Quirks &a, const Quirks &b) {
+        return !(a == b);
+    }
+
+    // One bit per quirk, for the binary formats (movies, save states)
+    std::uint8_t packQuirks(const Quirks &quirks);
+    Quirks unpackQuirks(std::uint8_t bits);
+
     enum class Extension {
         NONE,
         SCHIP
     };
 
+    // Everything needed to continue the emulation from some point. The structure is the in-memory form (quick slots,
+    // rewind, netplay rollback): it's trivially copyable, so it's taken and restored without any allocations. Its
+    // bytes depend on the compiler and the platform though, so the files are written field by field instead.
+    struct SaveState {
+        static constexpr std::uint32_t MAGIC   = 0x38504843; // "CHP8" in little-endian
+        // Must be bumped whenever the file format or the layout of this structure (or of VMState, Quirks, ...) changes
+        static constexpr std::uint32_t VERSION = 5;
+
+        SaveState() = default;
+        // Throws InvalidSaveState if the file cannot be read or isn't a save state of this version
+        explicit SaveState(const std::string &path);
+
+        void writeFile(const std::string &path) const;
+
+        std::uint32_t magic   = MAGIC;
+        std::uint32_t version = VERSION;
+        // See VM::romHash(), a save state can be loaded only with the same ROM
+        std::uint64_t romHash;
+
+        VMState state;
+        Extension ext;
+        Quirks quirks;
+
+        Display::Frame frame;
+        Resolution res;
+
+        // Timing, so the VM continues in the middle of a frame exactly where it stopped
+        std::int64_t pendingTime;
+        unsigned cycleRemainder;
+        std::uint64_t cycleCount;
+        std::uint64_t frameCount;
+
+        // FX0A
+        bool waitForKeyRelease;
+        std::uint8_t keyToRelease;
+    };
+
+    static_assert(std::is_trivially_copyable_v<SaveState>);
+
+    class InvalidSaveState : public VMError {
+    public:
+        InvalidSaveState();
+        InvalidSaveState(const std::string &err);
+    };
+
+    class Recompiler;
+    class Rewinder;
+    struct Movie;
+
     class VM {
     public:
-        VM(Display &display, Config &cfg);
+        // The config is owned by the caller, who may change it at any time. The VM only reads it: the state that
+        // the ROMs change (e.g. the RPL flags) is kept in VMState.
+        VM(const CPUConfig &cfg);
+        ~VM();
 
-        // Steps and updates the timers
+        // Runs all frames that are due since the last call, according to the wall clock. For the callers that don't
+        // pace the frames themselves (EmulationThread does, see runFrame(frameEnd)).
         void update();
+        // Emulates one frame: executes the instructions budgeted for it and decrements the timers. With run-ahead, a
+        // scratch copy of the VM emulates the next frames with the current keys (or the ones of the movie being
+        // played back) and its framebuffer is presented instead.
+        void runFrame();
+        // runFrame() for a caller that keeps the frame rate itself: the frame is the one that ends at frameEnd in the
+        // wall time, so the queued key events are placed within it. When uncapped, the instructions are executed
+        // for a time slice first, as in update().
+        void runFrame(std::chrono::steady_clock::time_point frameEnd);
+        // Just the emulation part of runFrame(): nothing is presented, recorded for rewinding or run ahead. Used to
+        // emulate frames that aren't shown (run-ahead, rollbacks).
+        void simulateFrame();
+        // Passes the display to the sink (if there's one) and clears its dirty rows
+        void present();
+        // Executes up to n instructions, returns how many of them were executed. Stops earlier on breakpoints or
+        // when the VM leaves the RUN mode.
+        std::size_t runCycles(std::size_t n);
         void step();
-        void updateInputTable(const SDL_Event &event);
+        void setKey(std::size_t key, bool pressed);
+        // Can be called from another thread than the one running the VM, without locking (but only from one). The
+        // key changes at the instruction that corresponds to the time within the frames emulated by update() or
+        // runFrame(frameEnd), and a press is held for at least a frame, so even a short tap is seen by the game.
+        // Returns false if the queue is full.
+        bool queueKey(std::size_t key, bool pressed, std::chrono::steady_clock::time_point time);
         void setExtension(Extension ext);
+        // Switches to the dispatch table specialized for the quirks
+        void setQuirks(const Quirks &quirks);
 
         void execInstr(std::uint16_t opcode);
+        // Must be called after writing to the memory (except for load()), so the instructions decoded from the
+        // written bytes are decoded again before their execution.
+        void memoryChanged(std::uint16_t addr, std::size_t size);
         std::optional<InstrKind> tryDecodeOpcode(std::uint16_t);
+        Instruction::Impl handler(std::uint16_t opcode) const;
+
+        void saveState(SaveState &save) const;
+        // Throws InvalidSaveState if the save state was made by an incompatible version or with another ROM than
+        // the loaded one (or none is loaded). Doesn't change the mode. Stops the recording, as the movie couldn't be
+        // replayed from its start anymore.
+        void loadState(const SaveState &save);
+        // Like loadState(), but for a save state taken earlier by this VM (rewind, netplay rollback): a movie being
+        // recorded continues from that point, the input made after it is discarded
+        void rollBackTo(const SaveState &save);
+        // Goes one frame back in the history recorded by runFrame() (see CPUConfig::rewindSeconds). The keys stay as
+        // they are now, the history doesn't press or release them. Returns false if there is no more history.
+        bool rewind();
+
+        // Resets the VM and records the key changes into the movie until stopRecording(). Only capped cycles/sec
+        // can be recorded, as uncapped frames depend on the wall time. A reset of the VM restarts the recording.
+        // Meanwhile the VM keeps the seed and the cycles/sec of the movie, even if they are changed in the config.
+        void startRecording(Movie &movie);
+        // Also fills the frame count and the display hash of the movie
+        void stopRecording();
+        // Resets the VM with the settings of the movie (seed, cycles/sec, quirks...) and feeds it the keys from the
+        // movie; setKey() is ignored meanwhile. The settings of the movie (including the extension, the quirks and
+        // the RPL flags) are used only until the playback stops, the config isn't changed. Throws MovieError if the
+        // ROM differs.
+        void startPlayback(const Movie &movie);
+        // Restores the extension, the quirks and the RPL flags from before the playback
+        void stopPlayback();
+        bool recording() const;
+        bool playingBack() const;
+        // Hash of the loaded ROM, identifies it in the movies
+        std::uint64_t romHash() const;
+        // Seeds the PRNG with this instead of CPUConfig::rngSeed on the following resets, until it's cleared with
+        // std::nullopt (e.g. the netplay sides must agree on the seed, but shouldn't change the config of the user)
+        void overrideRngSeed(std::optional<unsigned> seed);
+
+        // Returns an independent copy of the VM (e.g. for exploring the possible inputs of a ROM), that continues
+        // exactly as this VM would. The state (including the whole memory and the RPL flags) and the framebuffer are
+        // copied; only the ROM image and the decoded instructions are shared, the latter until one of the VMs changes
+        // them. The child gets no sinks, no rewind history and no movie. It reads the same config, which the VM
+        // never writes to.
+        std::unique_ptr<VM> fork() const;
 
         void load(std::vector<std::uint8_t> rom);
         void loadFile(const std::string &filename);
 
         void reset();
+        // Unlike reset(), also restores the memory as it was right after load()
+        void restart();
         void unload();
 
         std::string disassemble(std::uint16_t opcode);
@@ -123,24 +302,121 @@ namespace nchip8 {
         VMMode prevMode() const;
         VMMode mode() const;
         Extension ext() const;
+        const Quirks &quirks() const;
+        // Number of instructions executed and frames emulated since the VM was created
+        std::uint64_t cycleCount() const;
+        std::uint64_t frameCount() const;
+        // Whether the tone sounded during the last emulated frame
+        bool toneOn() const;
+        // Average time spent on running ahead per frame (see CPUConfig::runAheadFrames)
+        std::chrono::nanoseconds runAheadTime() const;
 
         VMState state;
-        Config &cfg;
-        Quirks quirks;
-        Display &display;
-        WaveformGenerator beeper;
+        const CPUConfig &cfg;
+        Display display;
+
+        // Both are optional
+        DisplaySink *displaySink = nullptr;
+        AudioSink *audioSink = nullptr;
 
         BreakpointMap breakpoints;
         bool waitForKeyRelease = false;
         std::size_t keyToRelease = 0;
 
     private:
+        // Used by fork()
+        VM(const VM &parent);
+
         InstrKind decodeOpcode(std::uint16_t opcode);
-        void loadInstrSet(Extension ext);
 
-        std::unordered_map<InstrKind, Instruction> m_instrSet;
+        static std::optional<InstrKind> tryDecodeOpcode(std::uint16_t opcode, Extension ext);
+        static const DispatchTable &dispatchTable(const Quirks &quirks, Extension ext);
+
+        void loadInstrSet();
+        std::uint16_t fetch(std::uint16_t addr) const;
+        void flushDecodeCache();
+        // Copies the decode cache first if it's shared with a fork
+        DecodeCache &writableDecodeCache();
+        // Applies the movie events due at the current instruction, returns the number of instructions until the next
+        // event
+        std::size_t applyMovieInput();
+        // Restores the memory to the state right after load(), as the movies start with it
+        void reloadRom();
+        // Presents the framebuffer from cfg.runAheadFrames frames in the future
+        void runAhead();
+        // Executes instructions as fast as possible for a while, the frames only decrement the timers then
+        void runUncappedSlice();
+        // Of the movie while one is recorded or played back, otherwise from the config
+        unsigned cyclesPerSec() const;
+        bool uncapCyclesPerSec() const;
+        // Of the movie being recorded, otherwise the overridden one or the one from the config
+        unsigned rngSeed() const;
+
+        using Clock = std::chrono::steady_clock;
+
+        struct KeyEvent {
+            Clock::time_point time;
+            std::uint8_t key;
+            bool pressed;
+        };
+
+        static constexpr std::size_t KEY_QUEUE_SIZE = 256;
+        static constexpr auto FRAME_DURATION = std::chrono::nanoseconds(1'000'000'000 / TIMER_FREQ);
+
+        // Executes the instructions of a frame, applying the queued key events that fall into it in between
+        void runFrameCycles(std::size_t cycles);
+        Clock::time_point keyEventTime(const KeyEvent &event) const;
+
+        const DispatchTable *m_dispatchTable = nullptr;
+        // Shared with the forks, copy-on-write
+        std::shared_ptr<DecodeCache> m_decodeCache;
+        // Created on the first use, see CPUConfig::useRecompiler
+        std::unique_ptr<Recompiler> m_recompiler;
+        // Created on the first frame if rewinding is enabled
+        std::unique_ptr<Rewinder> m_rewinder;
+
+        Clock::time_point m_lastUpdate = Clock::now();
+        // Wall time that has not been emulated yet, in nanoseconds multiplied by TIMER_FREQ (so a frame is exactly
+        // 10^9 units long and no rounding error accumulates)
+        std::int64_t m_pendingTime = 0;
+        // Fractional part of the per-frame instruction budget, in 1/TIMER_FREQ cycles
+        unsigned m_cycleRemainder = 0;
+
+        // Filled by queueKey(). A fork starts with an empty queue.
+        SpscRing<KeyEvent, KEY_QUEUE_SIZE> m_keyEvents;
+        // The wall time at which the frame emulated by update() or runFrame(frameEnd) ends
+        Clock::time_point m_frameEnd;
+        // When the keys were pressed, in the wall time
+        std::array<Clock::time_point, KEY_COUNT> m_keyPressTimes {};
+
+        std::uint64_t m_cycleCount = 0;
+        std::uint64_t m_frameCount = 0;
+        bool m_toneOn = false;
+
+        // Set in the VM that runs ahead: its frames are thrown away, so compiling code wouldn't pay off
+        bool m_speculative = false;
+        // Created on the first run-ahead, then just restored to the current state before every one
+        std::unique_ptr<VM> m_future;
+        std::chrono::nanoseconds m_runAheadTime { 0 };
+
+        // Shared with the forks, never modified
+        std::shared_ptr<const std::vector<std::uint8_t>> m_rom;
+        std::uint64_t m_romHash = 0;
+        std::optional<unsigned> m_rngSeed;
+        Movie *m_recording = nullptr;
+        const Movie *m_playback = nullptr;
+        std::size_t m_playbackPos = 0;
+        // The counters at the start of the movie being recorded or played back
+        std::uint64_t m_movieStartCycle = 0;
+        std::uint64_t m_movieStartFrame = 0;
+        // A replay shouldn't change the settings of the user, so they are restored when it stops
+        std::uint64_t m_rplFlagsBeforePlayback = 0;
+        Extension m_extBeforePlayback = Extension::NONE;
+        Quirks m_quirksBeforePlayback;
+
         VMMode m_mode = VMMode::EMPTY;
         VMMode m_prevMode;
         Extension m_ext = Extension::NONE;
+        Quirks m_quirks;
     };
 }
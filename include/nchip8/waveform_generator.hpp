@@ -3,9 +3,8 @@
 
 #pragma once
 
-#include "sdl.hpp"
-
 #include <array>
+#include <cstddef>
 #include <cstdint>
 
 namespace nchip8 {
@@ -15,27 +14,43 @@ namespace nchip8 {
         SAW
     };
 
+    // Synthesizes the beeper tone as signed 16-bit mono samples. Playing them is up to an AudioSink.
+    //
+    // One period of every waveform is precomputed into a table, which is read by a 32-bit phase accumulator: the
+    // phase wraps around exactly at the end of a period, so the tone can play forever without a click.
     class WaveformGenerator {
     public:
+        static constexpr int SAMPLE_RATE = 44100;
+
         WaveformGenerator(Waveform waveform, double level, int frequency);
 
-        void play();
+        void generate(std::int16_t *samples, std::size_t count);
         void changeWaveform(Waveform waveform);
+        // In dB
+        void setLevel(double level);
+        void setFrequency(int frequency);
 
-        double level;
-        int frequency;
+        double level() const;
+        int frequency() const;
 
     private:
-        // size is in samples, not in bytes (one sample is two bytes)
-        static constexpr int BUFFER_SIZE = 256;
-        static constexpr int SAMPLE_RATE = 44100;
+        static constexpr unsigned TABLE_BITS = 10;
+        static constexpr std::size_t TABLE_SIZE = std::size_t(1) << TABLE_BITS;
+
+        using Table = std::array<std::int16_t, TABLE_SIZE>;
 
-        inline double nextSample() const;
+        // Samples in the range [-1; 1] as Q15 fixed-point numbers
+        static const Table &table(Waveform waveform);
 
-        unsigned m_sampleCount = 0;
+        double m_level;
+        int m_frequency;
         Waveform m_waveform;
 
-        sdl::AudioDevice m_audioDevice;
-        std::array<std::int16_t, BUFFER_SIZE> m_buf;
+        const Table *m_table;
+        // A full period is 2^32
+        std::uint32_t m_phase = 0;
+        std::uint32_t m_phaseStep = 0;
+        // The amplitude of the samples, Q15
+        std::int32_t m_gain = 0;
     };
 }
@@ -0,0 +1,109 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#include <nchip8/audio_output.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace nchip8;
+
+namespace {
+    inline sdl::AudioSpec createSpec(int sampleRate, int sampleCount) {
+        return { sampleRate, AUDIO_S16LSB, 1, (std::uint16_t) sampleCount };
+    }
+
+    std::uint64_t msToSamples(int ms) {
+        return (std::uint64_t) std::max(ms, 0) * WaveformGenerator::SAMPLE_RATE / 1000;
+    }
+}
+
+AudioOutput::AudioOutput(const SoundConfig &cfg)
+    : m_cfg { cfg },
+      m_generator { cfg.waveform, cfg.level, cfg.frequency },
+      m_audioDevice { sdl::NullOpt, 0, createSpec(WaveformGenerator::SAMPLE_RATE, BUFFER_SIZE),
+          [this](std::uint8_t *stream, int len) { fill(stream, len); } } {
+    m_audioDevice.Pause(false);
+}
+
+void AudioOutput::frame(bool toneOn) {
+    std::uint64_t played = m_playedSamples.load(std::memory_order_acquire);
+    // The callback asks for a whole buffer at once, so anything sooner would be late
+    std::uint64_t target = played + std::max(msToSamples(m_cfg.latencyMs), (std::uint64_t) BUFFER_SIZE);
+
+    // After a stall (or when the clocks of the emulation and the sound card drifted too far apart) the schedule
+    // starts again from the target latency
+    if (m_frameStart < played + BUFFER_SIZE || m_frameStart > target + 2 * FRAME_SAMPLES) {
+        m_frameStart = target;
+    }
+
+    toneOn = toneOn && m_cfg.enable;
+
+    if (toneOn != m_reportedOn) {
+        m_events.push({ m_frameStart, toneOn, Clock::now() });
+        m_reportedOn = toneOn;
+    }
+
+    m_frameStart += FRAME_SAMPLES;
+    m_scheduledEnd.store(m_frameStart, std::memory_order_release);
+}
+
+void AudioOutput::applyConfig() {
+    // The generator is used by the callback
+    SDL_LockAudioDevice(m_audioDevice.Get());
+
+    m_generator.changeWaveform(m_cfg.waveform);
+    m_generator.setLevel(m_cfg.level);
+    m_generator.setFrequency(m_cfg.frequency);
+
+    SDL_UnlockAudioDevice(m_audioDevice.Get());
+}
+
+std::chrono::microseconds AudioOutput::latency() const {
+    return std::chrono::microseconds(m_latency.load(std::memory_order_relaxed));
+}
+
+void AudioOutput::fill(std::uint8_t *stream, int len) {
+    auto *samples = (std::int16_t *) stream;
+    auto count = (std::uint64_t) len / sizeof(std::int16_t);
+
+    std::uint64_t start = m_playedSamples.load(std::memory_order_relaxed);
+    std::uint64_t end = start + count;
+    std::uint64_t scheduledEnd = m_scheduledEnd.load(std::memory_order_acquire);
+    Clock::time_point now = Clock::now();
+
+    for (std::uint64_t position = start; position < end;) {
+        ToneEvent event;
+
+        // The late events take effect right away
+        while (m_events.peek(event) && event.sample <= position) {
+            m_toneOn = event.on;
+            m_events.pop();
+
+            // This buffer is played after the one the device is playing now
+            auto heard = now + std::chrono::microseconds((BUFFER_SIZE + position - start) * 1'000'000 /
+                                                         WaveformGenerator::SAMPLE_RATE);
+            m_latency.store(std::chrono::duration_cast<std::chrono::microseconds>(heard - event.reported).count(),
+                            std::memory_order_relaxed);
+        }
+
+        std::uint64_t until = end;
+
+        if (m_events.peek(event)) {
+            until = std::min(until, event.sample);
+        }
+
+        bool on = m_toneOn && position < scheduledEnd;
+
+        if (on) {
+            until = std::min(until, scheduledEnd);
+            m_generator.generate(samples + (position - start), until - position);
+        } else {
+            std::memset(samples + (position - start), 0, (until - position) * sizeof(std::int16_t));
+        }
+
+        position = until;
+    }
+
+    m_playedSamples.store(end, std::memory_order_release);
+}
@@ -0,0 +1,304 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+// nchip8-batch: runs many ROMs headlessly, each in its own VM, spread over a thread pool.
+//
+// Usage: nchip8-batch [options] <ROM list>
+//
+// The ROM list (or '-' for stdin) contains one ROM per line: its path, optionally followed by options separated
+// by spaces. The options are 'schip' (enables the SCHIP extension) and the quirks: 'jump-v0', 'wrap-x', 'wrap-y',
+// 'reset-vf', 'shift-vy', 'increment-i', '8x16-lores' and 'row-collisions'. A quirk is disabled by prefixing it
+// with 'no-'; the quirks that aren't mentioned keep their defaults. Empty lines and lines starting with '#' are
+// ignored.
+//
+// 'movie=<path>' replays an input movie instead: the extension, quirks, seed and cycles/sec are taken from it, the
+// ROM runs for as many frames as were recorded and the final framebuffer is checked against the recorded one.
+//
+// For every ROM a line with its path, executed instructions, emulated frames, the hash of the final framebuffer
+// and the status is printed, in the order of the list. A replay that doesn't end with the recorded framebuffer is
+// reported as a desync.
+
+#include <nchip8/movie.hpp>
+#include <nchip8/thread_pool.hpp>
+#include <nchip8/vm.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace nchip8;
+
+namespace {
+    struct Options {
+        std::size_t frames = 600;
+        std::size_t threads = 0;
+        unsigned cyclesPerSec = CPUConfig().cyclesPerSec;
+        unsigned seed = 0;
+        bool useRecompiler = false;
+        std::string listPath;
+    };
+
+    struct Job {
+        std::string path;
+        Extension ext = Extension::NONE;
+        Quirks quirks;
+        std::string moviePath;
+    };
+
+    struct Summary {
+        std::uint64_t instructions = 0;
+        std::uint64_t frames = 0;
+        std::uint64_t hash = 0;
+        bool exited = false;
+        bool desync = false;
+        std::string error;
+    };
+
+    void printUsage(std::ostream &out) {
+        out << "Usage: nchip8-batch [options] <ROM list>\n"
+               "Options:\n"
+               "  -f, --frames N      stop every ROM after N frames (default: 600)\n"
+               "  -j, --threads N     number of worker threads (default: one per hardware thread)\n"
+               "  -c, --cycles N      instructions per second (default: 250)\n"
+               "  -s, --seed N        seed of the PRNG (default: 0)\n"
+               "  -r, --recompiler    use the recompiler\n"
+               "  -h, --help          print this message\n";
+    }
+
+    unsigned long parseNumber(const std::string &option, const char *arg) {
+        if (!arg) {
+            throw std::invalid_argument("option '" + option + "' requires an argument");
+        }
+
+        char *end = nullptr;
+        unsigned long value = std::strtoul(arg, &end, 0);
+
+        if (*arg == '\0' || *end != '\0') {
+            throw std::invalid_argument("invalid number '" + std::string(arg) + "' for option '" + option + "'");
+        }
+
+        return value;
+    }
+
+    Options parseOptions(int argc, char **argv) {
+        Options opts;
+
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            const char *next = i + 1 < argc ? argv[i + 1] : nullptr;
+
+            if (arg == "-h" || arg == "--help") {
+                printUsage(std::cout);
+                std::exit(EXIT_SUCCESS);
+            } else if (arg == "-f" || arg == "--frames") {
+                opts.frames = parseNumber(arg, next);
+                ++i;
+            } else if (arg == "-j" || arg == "--threads") {
+                opts.threads = parseNumber(arg, next);
+                ++i;
+            } else if (arg == "-c" || arg == "--cycles") {
+                opts.cyclesPerSec = (unsigned) parseNumber(arg, next);
+                ++i;
+            } else if (arg == "-s" || arg == "--seed") {
+                opts.seed = (unsigned) parseNumber(arg, next);
+                ++i;
+            } else if (arg == "-r" || arg == "--recompiler") {
+                opts.useRecompiler = true;
+            } else if (arg.size() > 1 && arg[0] == '-') {
+                throw std::invalid_argument("unknown option '" + arg + "'");
+            } else if (opts.listPath.empty()) {
+                opts.listPath = arg;
+            } else {
+                throw std::invalid_argument("only one ROM list can be given");
+            }
+        }
+
+        if (opts.listPath.empty()) {
+            throw std::invalid_argument("no ROM list given");
+        }
+
+        return opts;
+    }
+
+    Job parseJob(const std::string &line, std::size_t lineNum) {
+        std::istringstream words(line);
+        Job job;
+        std::string word;
+
+        words >> job.path;
+
+        while (words >> word) {
+            bool enable = word.rfind("no-", 0) != 0;
+            std::string name = enable ? word : word.substr(3);
+
+            if (word.rfind("movie=", 0) == 0) {
+                job.moviePath = word.substr(6);
+            } else if (name == "schip" && enable) {
+                job.ext = Extension::SCHIP;
+            } else if (name == "jump-v0") {
+                job.quirks.jumpOffsetUseV0 = enable;
+            } else if (name == "wrap-x") {
+                job.quirks.wrapPixelsX = enable;
+            } else if (name == "wrap-y") {
+                job.quirks.wrapPixelsY = enable;
+            } else if (name == "reset-vf") {
+                job.quirks.bitwiseResetVF = enable;
+            } else if (name == "shift-vy") {
+                job.quirks.shiftSetVxToVy = enable;
+            } else if (name == "increment-i") {
+                job.quirks.loadSaveIncrementI = enable;
+            } else if (name == "8x16-lores") {
+                job.quirks.draw8x16SpriteInLores = enable;
+            } else if (name == "row-collisions") {
+                job.quirks.collisionCountRows = enable;
+            } else {
+                throw std::invalid_argument("line " + std::to_string(lineNum) + ": unknown option '" + word + "'");
+            }
+        }
+
+        return job;
+    }
+
+    std::vector<Job> readJobs(std::istream &in) {
+        std::vector<Job> jobs;
+        std::string line;
+        std::size_t lineNum = 0;
+
+        while (std::getline(in, line)) {
+            ++lineNum;
+
+            std::size_t begin = line.find_first_not_of(" \t\r");
+
+            if (begin == std::string::npos || line[begin] == '#') {
+                continue;
+            }
+
+            jobs.push_back(parseJob(line.substr(begin), lineNum));
+        }
+
+        return jobs;
+    }
+
+    Summary run(const Job &job, const Options &opts) {
+        Summary summary;
+
+        // Every VM gets its own config, the VMs share nothing
+        CPUConfig cfg;
+        cfg.cyclesPerSec = opts.cyclesPerSec;
+        cfg.useRecompiler = opts.useRecompiler;
+        cfg.rngSeed = opts.seed;
+        cfg.rewindSeconds = 0;
+
+        VM vm(cfg);
+
+        try {
+            vm.setExtension(job.ext);
+            vm.setQuirks(job.quirks);
+            vm.display.wrapPixelsX = job.quirks.wrapPixelsX;
+            vm.display.wrapPixelsY = job.quirks.wrapPixelsY;
+            vm.loadFile(job.path);
+            vm.setMode(VMMode::RUN);
+
+            std::size_t frames = opts.frames;
+            Movie movie;
+
+            if (!job.moviePath.empty()) {
+                movie = Movie(job.moviePath);
+                vm.startPlayback(movie);
+
+                frames = (std::size_t) movie.frameCount;
+            }
+
+            summary.hash = vm.display.hash();
+
+            for (std::size_t i = 0; i < frames; ++i) {
+                vm.runFrame();
+
+                // EXIT (00FD) unloads the ROM and clears the display, so keep the hash of the last frame before it
+                if (vm.mode() == VMMode::EMPTY) {
+                    summary.exited = true;
+
+                    break;
+                }
+
+                summary.hash = vm.display.hash();
+            }
+
+            // After EXIT the framebuffer is gone, so only a finished replay can be checked
+            if (!job.moviePath.empty() && !summary.exited) {
+                summary.desync = summary.hash != movie.finalDisplayHash;
+            }
+        } catch (const std::exception &err) {
+            summary.error = err.what();
+        }
+
+        summary.instructions = vm.cycleCount();
+        summary.frames = vm.frameCount();
+
+        return summary;
+    }
+}
+
+int main(int argc, char **argv) {
+    Options opts;
+    std::vector<Job> jobs;
+
+    try {
+        opts = parseOptions(argc, argv);
+
+        if (opts.listPath == "-") {
+            jobs = readJobs(std::cin);
+        } else {
+            std::ifstream list(opts.listPath);
+
+            if (!list) {
+                throw std::runtime_error("file '" + opts.listPath + "' cannot be opened");
+            }
+
+            jobs = readJobs(list);
+        }
+    } catch (const std::exception &err) {
+        std::cerr << "nchip8-batch: " << err.what() << '\n';
+        printUsage(std::cerr);
+
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Summary> summaries(jobs.size());
+
+    {
+        ThreadPool pool(opts.threads);
+
+        for (std::size_t i = 0; i < jobs.size(); ++i) {
+            pool.submit([&, i] { summaries[i] = run(jobs[i], opts); });
+        }
+
+        pool.wait();
+    }
+
+    int failed = 0;
+
+    std::cout << "rom\tinstructions\tframes\thash\tstatus\n";
+
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+        const Summary &summary = summaries[i];
+
+        std::cout << jobs[i].path << '\t' << summary.instructions << '\t' << summary.frames << '\t'
+                  << std::hex << std::setw(16) << std::setfill('0') << summary.hash << std::dec << '\t';
+
+        if (!summary.error.empty()) {
+            std::cout << "error: " << summary.error << '\n';
+            ++failed;
+        } else {
+            std::cout << (summary.desync ? "desync" : summary.exited ? "exited" : "ok") << '\n';
+            failed += summary.desync;
+        }
+    }
+
+    return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
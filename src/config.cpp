@@ -9,6 +9,19 @@
 
 using namespace nchip8;
 
+KeyMap nchip8::makeKeyMap(const InputLayout &layout) {
+    KeyMap map;
+    map.fill(-1);
+
+    for (const auto &key : layout) {
+        if (key.first >= 0 && key.first < SDL_NUM_SCANCODES) {
+            map[(std::size_t) key.first] = (std::int8_t) key.second;
+        }
+    }
+
+    return map;
+}
+
 Config::Config(const std::string &path) : savePath { path } {
     toml::value root = toml::parse(path);
 
@@ -18,7 +31,7 @@ Config::Config(const std::string &path) : savePath { path } {
     const auto &soundTable    = toml::find_or(root, "sound", {});
     const auto &uiTable       = toml::find_or(root, "ui", {});
     
-    auto u32ToColor = [](std::uint32_t color) -> sdl::Color {
+    auto u32ToColor = [](std::uint32_t color) -> Color {
         std::uint8_t r = (color & 0xff000000) >> 24;
         std::uint8_t g = (color & 0x00ff0000) >> 16;
         std::uint8_t b = (color & 0x0000ff00) >>  8;
@@ -36,10 +49,16 @@ Config::Config(const std::string &path) : savePath { path } {
     graphics.windowSize.y = toml::find_or(graphicsTable, "windowHeight", LORES_DISPLAY_SIZE.y * 10);
     graphics.scaleFactor  = toml::find_or(graphicsTable, "scaleFactor", 1);
     graphics.enableFade   = toml::find_or(graphicsTable, "enableFade", false);
+    graphics.vsync        = toml::find_or(graphicsTable, "vsync", true);
+    graphics.frameCap     = toml::find_or(graphicsTable, "frameCap", 60);
 
     cpu.cyclesPerSec      = toml::find_or(cpuTable, "cyclesPerSec", 250u);
     cpu.uncapCyclesPerSec = toml::find_or(cpuTable, "uncapCyclesPerSec", false);
+    cpu.useRecompiler     = toml::find_or(cpuTable, "useRecompiler", false);
     cpu.rplFlags          = toml::find_or(cpuTable, "rplFlags", (std::uint64_t) 0);
+    cpu.rewindSeconds     = toml::find_or(cpuTable, "rewindSeconds", 300u);
+    cpu.rewindMemoryMB    = toml::find_or(cpuTable, "rewindMemoryMB", 64u);
+    cpu.runAheadFrames    = toml::find_or(cpuTable, "runAheadFrames", 0u);
 
     input.layoutIdx = toml::find_or(inputTable, "layoutIdx", 1); // Modern layout
     input.layout    = input.layoutIdx == 0 ? ORIGINAL_LAYOUT : MODERN_LAYOUT;
@@ -48,6 +67,7 @@ Config::Config(const std::string &path) : savePath { path } {
     sound.level     = toml::find_or(soundTable, "level", 3.00); // dB
     sound.frequency = toml::find_or(soundTable, "frequency", 440);
     sound.waveform  = (Waveform) toml::find_or(soundTable, "waveform", (int) Waveform::SQUARE);
+    sound.latencyMs = toml::find_or(soundTable, "latencyMs", 50);
 
     ui.style = (ui::UIStyle) toml::find_or(uiTable, "style", (int) ui::UIStyle::DARK);
 }
@@ -57,7 +77,7 @@ void Config::writeFile() const {
 }
 
 void Config::writeFile(const std::string &path) const {
-    auto colorToU32 = [](sdl::Color color) -> std::uint32_t {
+    auto colorToU32 = [](Color color) -> std::uint32_t {
         return std::uint32_t ((color.r << 24) | (color.g << 16) | (color.b << 8) | color.a);
     };
 
@@ -74,10 +94,16 @@ void Config::writeFile(const std::string &path) const {
     graphicsTable["windowHeight"] = graphics.windowSize.y;
     graphicsTable["scaleFactor"]  = graphics.scaleFactor;
     graphicsTable["enableFade"]   = graphics.enableFade;
+    graphicsTable["vsync"]        = graphics.vsync;
+    graphicsTable["frameCap"]     = graphics.frameCap;
 
     cpuTable["cyclesPerSec"]      = cpu.cyclesPerSec;
     cpuTable["uncapCyclesPerSec"] = cpu.uncapCyclesPerSec;
+    cpuTable["useRecompiler"]     = cpu.useRecompiler;
     cpuTable["rplFlags"]          = cpu.rplFlags;
+    cpuTable["rewindSeconds"]     = cpu.rewindSeconds;
+    cpuTable["rewindMemoryMB"]    = cpu.rewindMemoryMB;
+    cpuTable["runAheadFrames"]    = cpu.runAheadFrames;
 
     inputTable["layoutIdx"] = input.layoutIdx;
 
@@ -85,6 +111,7 @@ void Config::writeFile(const std::string &path) const {
     soundTable["level"]     = sound.level;
     soundTable["frequency"] = sound.frequency;
     soundTable["waveform"]  = (int) sound.waveform;
+    soundTable["latencyMs"] = sound.latencyMs;
 
     uiTable["style"] = (int) ui.style;
 
@@ -3,167 +3,144 @@
 
 #include <nchip8/display.hpp>
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 
 using namespace nchip8;
 
-Display::Display(sdl::Renderer &renderer)
-    : m_lines     { HIRES_DISPLAY_SIZE.y },
-      m_renderer  { renderer },
-      m_texture   { renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, TEXTURE_SIZE.x, TEXTURE_SIZE.y } {
-    setResolution(Resolution::LOW);
-}
-
-void Display::prepare() {
-    auto drawPixel = [this](sdl::Point pos, sdl::Color color) {
-        sdl::Rect pixel(pos * m_pixelSize, m_pixelSize);
+namespace {
+    // Moves the pixels n columns to the right (towards the higher bits)
+    void shiftRight(Display::Line &line, std::size_t n) {
+        std::size_t words = n / 64;
+        std::size_t bits  = n % 64;
 
-        m_renderer.SetDrawColor(color);
-        m_renderer.FillRect(pixel);
+        // From the highest word, so the words read are still unchanged
+        for (std::size_t i = Display::LINE_WORDS; i-- > 0;) {
+            std::uint64_t src   = i >= words     ? line[i - words]     : 0;
+            std::uint64_t carry = i >= words + 1 ? line[i - words - 1] : 0;
 
-        if (m_enableGrid) {
-            // Color of the grid is the inverted color of pixel (except for its alpha channel)
-            color.r = ~color.r;
-            color.g = ~color.g;
-            color.b = ~color.b;
-
-            m_renderer.SetDrawColor(color);
-            m_renderer.DrawRect(pixel);
+            line[i] = bits ? src << bits | carry >> (64 - bits) : src;
         }
-    };
-
-    auto fadePixels = [this, drawPixel]() {
-        std::uint32_t currentTime = SDL_GetTicks();
-        std::uint32_t deltaTime = currentTime - m_lastlyFaded;
-
-        if (deltaTime >= 10) {
-            m_lastlyFaded = currentTime;
+    }
 
-            for (auto it = m_fadePixels.begin(); it != m_fadePixels.end();) {
-                auto &px = it->second;
+    // Moves the pixels n columns to the left (towards the lower bits)
+    void shiftLeft(Display::Line &line, std::size_t n) {
+        std::size_t words = n / 64;
+        std::size_t bits  = n % 64;
 
-                px.fade(m_fadeSpeed);
-                drawPixel(px.pos, px.color);
+        for (std::size_t i = 0; i < Display::LINE_WORDS; ++i) {
+            std::uint64_t src   = i + words     < Display::LINE_WORDS ? line[i + words]     : 0;
+            std::uint64_t carry = i + words + 1 < Display::LINE_WORDS ? line[i + words + 1] : 0;
 
-                if (px.faded()) {
-                    it = m_fadePixels.erase(it);
-                } else {
-                    ++it;
-                }
-            }
+            line[i] = bits ? src >> bits | carry << (64 - bits) : src;
         }
-    };
-
-    auto drawBuffer = [this, drawPixel]() {
-        for (auto lineN : m_updatedLines) {
-            const auto &line = m_lines[lineN];
-
-            for (std::size_t i = line.updatedRegion.begin; i != line.updatedRegion.end; ++i) {
-                auto color = line.data[i] ? m_onColor : m_offColor;
-
-                drawPixel({ (int) i, (int) lineN }, color);
-            }
-        }
-    };
+    }
 
-    // We're writing our display buffer to the texture to speed up rendering
-    m_renderer.SetTarget(m_texture);
+    // Mirrors a sprite row, so its leftmost pixel ends up in the lowest bit like in a line
+    std::uint16_t reverseBits(std::uint16_t v) {
+        v = (std::uint16_t) ((v >> 1 & 0x5555) | (v & 0x5555) << 1);
+        v = (std::uint16_t) ((v >> 2 & 0x3333) | (v & 0x3333) << 2);
+        v = (std::uint16_t) ((v >> 4 & 0x0f0f) | (v & 0x0f0f) << 4);
 
-    if (m_enableFade) {
-        fadePixels();
+        return (std::uint16_t) (v >> 8 | v << 8);
     }
+}
 
-    if (m_changed) {
-        drawBuffer();
-    }
+Display::Display() {
+    setResolution(Resolution::LOW);
+}
 
-    // Reset target to the default
-    m_renderer.SetTarget();
+void Display::clear() {
+    // Only the visible columns are cleared, in lores that's just the first word of a line
+    if (m_res == Resolution::HIGH) {
+        std::memset(m_lines.data(), 0, sizeof(m_lines));
+    } else {
+        for (std::size_t y = 0; y < (std::size_t) m_size.y; ++y) {
+            m_lines[y][0] = 0;
+        }
+    }
 
-    m_updatedLines.clear();
-    m_changed = false;
+    m_dirtyRows = ~std::uint64_t(0);
 }
 
-void Display::draw() {
-    sdl::Rect part = { { 0, 0 }, m_size * m_pixelSize };
+void Display::setPixel(Point pos, PixelState state) {
+    std::uint64_t &word = m_lines[(std::size_t) pos.y][(std::size_t) pos.x / 64];
+    std::uint64_t bit = std::uint64_t(1) << (pos.x % 64);
 
-    float oldScaleX = m_renderer.GetXScale();
-    float oldScaleY = m_renderer.GetYScale();
-
-    m_renderer.SetScale((float) m_scaleFactor, (float) m_scaleFactor);
-    m_renderer.Copy(m_texture, sdl::NullOpt, part);
-    m_renderer.SetScale(oldScaleX, oldScaleY);
+    word = state == PixelState::ON ? word | bit : word & ~bit;
+    m_dirtyRows |= std::uint64_t(1) << pos.y;
 }
 
-void Display::clear() {
-    for (std::size_t y = 0; y < (std::size_t) m_size.y; ++y) {
-        auto &line = m_lines[y];
+PixelState Display::at(Point pos) const {
+    return (PixelState) pixel(m_lines[(std::size_t) pos.y], (std::size_t) pos.x);
+}
 
-        for (std::size_t x = 0; x < (std::size_t) m_size.x; ++x) {
-            if (line.data[x]) {
-                sdl::Point pos = { (int) x, (int) y };
+const Display::Line &Display::line(std::size_t y) const {
+    return m_lines[y];
+}
 
-                if (m_enableFade) {
-                    m_fadePixels.insert({ pos, { pos, m_onColor, m_offColor } });
-                }
+SpriteCollision Display::drawSprite(const Sprite &sprite) {
+    SpriteCollision collision;
 
-                line.data[x] = 0;
-            }
-        }
-    }
+    // A row of the sprite covers at most the word of its first column and the next one. The word after the visible
+    // ones gets the pixels past the right edge, which either wrap to the first word or are dropped.
+    auto x = (std::size_t) sprite.pos.x;
+    std::size_t word = x / 64;
+    std::size_t bit = x % 64;
+    auto visibleWords = (std::size_t) m_size.x / 64;
+    auto rowMask = (std::uint16_t) ((1u << sprite.width) - 1);
 
-    updateAllLines();
-}
+    for (int i = 0; i < sprite.height; ++i) {
+        int y = sprite.pos.y + i;
 
-void Display::setPixel(sdl::Point pos, PixelState state) {
-    std::size_t posX = (std::size_t) pos.x;
-    std::size_t posY = (std::size_t) pos.y;
-    std::uint8_t bit = (std::uint8_t) state;
+        if (y >= m_size.y) {
+            if (!wrapPixelsY) {
+                ++collision.clippedRows;
 
-    auto &line = m_lines[posY];
+                continue;
+            }
 
-    if (m_fadePixels.count(pos)) {
-        m_fadePixels.erase(pos);
-    }
+            // A sprite is never taller than the display
+            y -= m_size.y;
+        }
 
-    if (m_enableFade && !bit && line.data[posX]) {
-        m_fadePixels.insert({ pos, { pos, m_onColor, m_offColor } });
-    }
+        auto row = (std::uint16_t) (sprite.rows[(std::size_t) i] & rowMask);
+        std::uint64_t bits = reverseBits(row) >> (16 - sprite.width);
 
-    line.data[posX] = bit;
+        std::array<std::uint64_t, LINE_WORDS + 1> placed {};
+        placed[word] = bits << bit;
 
-    auto &region = line.updatedRegion;
-    region.begin = std::min(region.begin, posX);
-    region.end = std::max(region.end, posX);
+        if (bit > 0) {
+            placed[word + 1] = bits >> (64 - bit);
+        }
 
-    m_updatedLines.insert(posY);
-    m_changed = true;
-}
+        Line mask {};
+        std::copy_n(placed.begin(), visibleWords, mask.begin());
 
-PixelState Display::at(sdl::Point pos) const {
-    return (PixelState) m_lines[(std::size_t) pos.y].data[(std::size_t) pos.x];
-}
+        if (wrapPixelsX) {
+            mask[0] |= placed[visibleWords];
+        }
 
-bool Display::drawSprite(const Sprite &sprite) {
-    auto height = (int) sprite.pixels.size();
-    bool collisionDetected = false;
-    unsigned mask = sprite.width > 8 ? 0x8000 : 0x80;
+        Line &line = m_lines[(std::size_t) y];
+        std::uint64_t overlap = 0;
+        std::uint64_t drawn = 0;
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < sprite.width; ++x) {
-            std::uint16_t row = sprite.pixels[(std::size_t) y];
+        for (std::size_t w = 0; w < LINE_WORDS; ++w) {
+            overlap |= line[w] & mask[w];
+            drawn |= mask[w];
+            line[w] ^= mask[w];
+        }
 
-            if (!(row & (mask >> x))) {
-                continue;
-            }
+        collision.collidedRows += overlap != 0;
 
-            if (drawSpritePixel({ sprite.pos.x + x, sprite.pos.y + y })) {
-                collisionDetected = true;
-            }
+        if (drawn) {
+            m_dirtyRows |= std::uint64_t(1) << y;
         }
     }
 
-    return collisionDetected;
+    return collision;
 }
 
 void Display::scroll(ScrollDirection dir, int n) {
@@ -171,31 +148,33 @@ void Display::scroll(ScrollDirection dir, int n) {
         n /= 2;
     }
 
+    auto rows = (std::size_t) m_size.y;
+    auto count = (std::size_t) std::max(n, 0);
+
     switch (dir) {
     case ScrollDirection::DOWN:
-        for (int i = 0; i < n; ++i) {
-            // Push an empty line at the top of display
-            m_lines.push_front({ });
-            // Remove the last line
-            m_lines.pop_back();
-        }
+        count = std::min(count, rows);
+
+        // The lines scrolled out at the bottom are lost, empty lines come in at the top
+        std::memmove(m_lines.data() + count, m_lines.data(), (rows - count) * sizeof(Line));
+        std::memset(m_lines.data(), 0, count * sizeof(Line));
 
         break;
     case ScrollDirection::RIGHT:
-        for (auto &line : m_lines) {
-            line.data <<= (std::size_t) n;
+        for (std::size_t y = 0; y < rows; ++y) {
+            shiftRight(m_lines[y], count);
         }
 
         break;
     case ScrollDirection::LEFT:
-        for (auto &line : m_lines) {
-            line.data >>= (std::size_t) n;
+        for (std::size_t y = 0; y < rows; ++y) {
+            shiftLeft(m_lines[y], count);
         }
 
         break;
     }
 
-    updateAllLines();
+    m_dirtyRows = ~std::uint64_t(0);
 }
 
 void Display::setResolution(Resolution res) {
@@ -203,61 +182,47 @@ void Display::setResolution(Resolution res) {
 
     switch (res) {
     case Resolution::LOW:
-        m_lines.resize((std::size_t) LORES_DISPLAY_SIZE.y);
-        m_pixelSize = LORES_PIXEL_SIZE;
+        // The lines below the lores display are dropped
+        std::memset(&m_lines[(std::size_t) LORES_DISPLAY_SIZE.y], 0,
+                    (std::size_t) (HIRES_DISPLAY_SIZE.y - LORES_DISPLAY_SIZE.y) * sizeof(Line));
         m_size = LORES_DISPLAY_SIZE;
 
         break;
     case Resolution::HIGH:
-        m_lines.resize((std::size_t) HIRES_DISPLAY_SIZE.y);
-        m_pixelSize = HIRES_PIXEL_SIZE;
         m_size = HIRES_DISPLAY_SIZE;
 
         break;
     }
 
-    updateAllLines();
-}
-
-void Display::setScaleFactor(int factor) {
-    m_scaleFactor = factor;
-
-    updateAllLines();
+    m_dirtyRows = ~std::uint64_t(0);
 }
 
-void Display::setOffColor(sdl::Color color) {
-    m_offColor = color;
-    m_fadePixels.clear();
-
-    updateAllLines();
+void Display::copyTo(Frame &frame) const {
+    frame = m_lines;
 }
 
-void Display::setOnColor(sdl::Color color) {
-    m_onColor = color;
-    m_fadePixels.clear();
+void Display::restore(const Frame &frame, Resolution res) {
+    if (res != m_res) {
+        setResolution(res);
+    }
 
-    updateAllLines();
+    std::memcpy(m_lines.data(), frame.data(), (std::size_t) m_size.y * sizeof(Line));
+    m_dirtyRows = ~std::uint64_t(0);
 }
 
-void Display::setFadeSpeed(double speed) {
-    m_fadeSpeed = speed * 0.005;
+std::uint64_t Display::dirtyRows() const {
+    return m_dirtyRows;
 }
 
-void Display::enableGrid(bool enable) {
-    m_enableGrid = enable;
-
-    updateAllLines();
+void Display::clearDirtyRows() {
+    m_dirtyRows = 0;
 }
 
-void Display::enableFade(bool enable) {
-    m_enableFade = enable;
-
-    if (!enable) {
-        m_fadePixels.clear();
-    }
+void Display::markAllRowsDirty() {
+    m_dirtyRows = ~std::uint64_t(0);
 }
 
-sdl::Point Display::size() const {
+Point Display::size() const {
     return m_size;
 }
 
@@ -265,99 +230,22 @@ Resolution Display::res() const {
     return m_res;
 }
 
-int Display::scaleFactor() const {
-    return m_scaleFactor;
-}
-
-sdl::Color Display::offColor() const {
-    return m_offColor;
-}
+std::uint64_t Display::hash() const {
+    std::uint64_t hash = 0xcbf29ce484222325;
 
-sdl::Color Display::onColor() const {
-    return m_onColor;
-}
-
-bool Display::gridEnabled() const {
-    return m_enableGrid;
-}
-
-bool Display::fadeEnabled() const {
-    return m_enableFade;
-}
-
-void Display::updateAllLines() {
-    for (std::size_t i = 0; i < m_lines.size(); ++i) {
-        auto &line = m_lines[i];
-
-        line.updatedRegion.begin = 0;
-        line.updatedRegion.end   = (std::size_t) m_size.x;
-
-        m_updatedLines.insert(i);
-    }
-
-    m_changed = true;
-}
+    for (std::size_t y = 0; y < (std::size_t) m_size.y; ++y) {
+        const Line &line = m_lines[y];
 
-bool Display::drawSpritePixel(sdl::Point pos) {
-    bool collisionDetected = false;
+        for (std::size_t x = 0; x < (std::size_t) m_size.x; x += 8) {
+            std::uint8_t byte = 0;
 
-    if (pos.x >= m_size.x) {
-        if (wrapPixelsX) {
-            pos.x %= m_size.x;
-        } else {
-            return false;
-        }
-    }
+            for (std::size_t bit = 0; bit < 8; ++bit) {
+                byte = (std::uint8_t) (byte << 1 | pixel(line, x + bit));
+            }
 
-    if (pos.y >= m_size.y) {
-        if (wrapPixelsY) {
-            pos.y %= m_size.y;
-        } else {
-            return false;
+            hash = (hash ^ byte) * 0x100000001b3;
         }
     }
 
-    PixelState pxState = at(pos);
-
-    if (pxState == PixelState::ON) {
-        collisionDetected = true;
-    }
-
-    setPixel(pos, !pxState);
-
-    return collisionDetected;
-}
-
-Display::FadePixel::FadePixel(sdl::Point pos, sdl::Color color, sdl::Color offColor)
-    : pos { pos }, color { color }, offColor { offColor } {
-        auto isGreater = [](sdl::Color a, sdl::Color b) -> bool {
-            return a.r > b.r || a.g > b.g || a.b > b.b;
-        };
-
-        step = isGreater(color, offColor) ? -step : step;
-    }
-
-void Display::FadePixel::fade(double speed) {
-    auto fadeColor = [this, speed](std::uint8_t pxColor, std::uint8_t refColor) -> std::uint8_t {
-        if (pxColor == refColor) {
-            return pxColor;
-        }
-
-        double result = pxColor + step * speed;
-
-        if ((std::signbit(step) && result < refColor) ||
-           (!std::signbit(step) && result > refColor)) {
-            result = refColor;
-        }
-
-        return (std::uint8_t) result;
-    };
-
-    color.r = fadeColor(color.r, offColor.r);
-    color.g = fadeColor(color.g, offColor.g);
-    color.b = fadeColor(color.b, offColor.b);
-}
-
-bool Display::FadePixel::faded() const {
-    return color == offColor;
+    return hash;
 }
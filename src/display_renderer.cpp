@@ -0,0 +1,325 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#include <nchip8/display_renderer.hpp>
+#include <nchip8/vm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+
+using namespace nchip8;
+
+namespace {
+    std::uint32_t toRGBA8888(Color color) {
+        return (std::uint32_t) color.r << 24 | (std::uint32_t) color.g << 16 | (std::uint32_t) color.b << 8 | color.a;
+    }
+}
+
+DisplayRenderer::DisplayRenderer(sdl::Renderer &renderer)
+    : m_renderer  { renderer },
+      m_texture   { renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, TEXTURE_SIZE.x, TEXTURE_SIZE.y },
+      m_grid      { renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, GRID_SIZE.x, GRID_SIZE.y } {
+    SDL_SetTextureScaleMode(m_texture.Get(), SDL_ScaleModeNearest);
+    updateRamp();
+
+    // result = grid * (1 - display) + display * (1 - grid), so white inverts the display and black leaves it as is
+    SDL_BlendMode invert = SDL_ComposeCustomBlendMode(SDL_BLENDFACTOR_ONE_MINUS_DST_COLOR,
+                                                      SDL_BLENDFACTOR_ONE_MINUS_SRC_COLOR, SDL_BLENDOPERATION_ADD,
+                                                      SDL_BLENDFACTOR_ZERO, SDL_BLENDFACTOR_ONE, SDL_BLENDOPERATION_ADD);
+
+    // Not every renderer supports custom blend modes (e.g. the software one)
+    m_gridBlendingSupported = SDL_SetTextureBlendMode(m_grid.Get(), invert) == 0;
+}
+
+void DisplayRenderer::present(const Display &display) {
+    PresentedFrame &frame = m_presented.back();
+
+    display.copyTo(frame.lines);
+    frame.res = display.res();
+    frame.number = ++m_presentedCount;
+
+    m_presented.publish();
+
+    if (display.dirtyRows() != 0 || display.res() != m_presentedRes || m_glowing) {
+        m_changed = true;
+    }
+
+    m_presentedRes = display.res();
+}
+
+bool DisplayRenderer::takeChanged() {
+    bool changed = m_changed;
+    m_changed = false;
+
+    return changed;
+}
+
+void DisplayRenderer::takePresentedFrame() {
+    if (!m_presented.update()) {
+        return;
+    }
+
+    const PresentedFrame &frame = m_presented.front();
+
+    if (frame.res != m_res) {
+        m_res = frame.res;
+        m_size = m_res == Resolution::LOW ? LORES_DISPLAY_SIZE : HIRES_DISPLAY_SIZE;
+        m_pixelSize = m_res == Resolution::LOW ? LORES_PIXEL_SIZE : HIRES_PIXEL_SIZE;
+
+        m_intensity.fill(0);
+        m_dirtyRows = ~std::uint64_t(0);
+        m_gridBuilt = false;
+    }
+
+    // The afterglow fades once per emulated frame (including the skipped ones), before the pixels turned off in
+    // this one start to glow
+    if (m_enableFade) {
+        fadePixels(frame.number - m_lastFrameNumber);
+    }
+
+    m_lastFrameNumber = frame.number;
+
+    // The frames skipped since the last one taken aren't known, so all rows are compared
+    for (std::size_t y = 0; y < (std::size_t) m_size.y; ++y) {
+        const auto &line = frame.lines[y];
+        Display::Line changed;
+        bool anyChanged = false;
+
+        for (std::size_t i = 0; i < Display::LINE_WORDS; ++i) {
+            changed[i] = line[i] ^ m_frame[y][i];
+            anyChanged |= changed[i] != 0;
+        }
+
+        if (!anyChanged) {
+            continue;
+        }
+
+        // Pixels that have been turned off fade away. The afterglow of the ones turned on again doesn't matter, it's
+        // hidden until they're off.
+        if (m_enableFade) {
+            std::uint8_t *intensity = &m_intensity[y * (std::size_t) TEXTURE_SIZE.x];
+
+            for (std::size_t x = 0; x < (std::size_t) m_size.x; ++x) {
+                if (Display::pixel(changed, x) && !Display::pixel(line, x)) {
+                    intensity[x] = 255;
+                }
+            }
+
+            m_glowing = true;
+        }
+
+        m_frame[y] = line;
+        m_dirtyRows |= std::uint64_t(1) << y;
+    }
+}
+
+void DisplayRenderer::prepare() {
+    takePresentedFrame();
+
+    if (m_enableGrid && m_gridBlendingSupported && !m_gridBuilt) {
+        buildGrid();
+    }
+
+    auto rows = (std::size_t) m_size.y;
+    std::uint64_t dirtyRows = m_dirtyRows & (rows < 64 ? (std::uint64_t(1) << rows) - 1 : ~std::uint64_t(0));
+
+    if (!dirtyRows) {
+        return;
+    }
+
+    std::size_t first = rows;
+    std::size_t last = 0;
+
+    for (std::size_t y = 0; y < rows; ++y) {
+        if (dirtyRows >> y & 1) {
+            convertRow(y);
+
+            first = std::min(first, y);
+            last = y;
+        }
+    }
+
+    // One upload of the rectangle covering all changed rows
+    sdl::Rect rect(0, (int) first, m_size.x, (int) (last - first + 1));
+    int pitch = TEXTURE_SIZE.x * (int) sizeof(std::uint32_t);
+    m_texture.Update(rect, &m_pixels[first * (std::size_t) TEXTURE_SIZE.x], pitch);
+
+    m_dirtyRows = 0;
+}
+
+void DisplayRenderer::draw() {
+    sdl::Rect source = { { 0, 0 }, toSDL(m_size) };
+    sdl::Rect part = { { 0, 0 }, toSDL(m_size * m_pixelSize) };
+
+    float oldScaleX = m_renderer.GetXScale();
+    float oldScaleY = m_renderer.GetYScale();
+
+    m_renderer.SetScale((float) m_scaleFactor, (float) m_scaleFactor);
+    m_renderer.Copy(m_texture, source, part);
+
+    if (m_enableGrid) {
+        if (m_gridBlendingSupported) {
+            m_renderer.Copy(m_grid, sdl::NullOpt, part);
+        } else {
+            drawGridOutlines();
+        }
+    }
+
+    m_renderer.SetScale(oldScaleX, oldScaleY);
+}
+
+void DisplayRenderer::setScaleFactor(int factor) {
+    m_scaleFactor = factor;
+}
+
+void DisplayRenderer::setOffColor(Color color) {
+    m_offColor = color;
+    updateRamp();
+    m_dirtyRows = ~std::uint64_t(0);
+}
+
+void DisplayRenderer::setOnColor(Color color) {
+    m_onColor = color;
+    updateRamp();
+    m_dirtyRows = ~std::uint64_t(0);
+}
+
+void DisplayRenderer::setFadeSpeed(double speed) {
+    // The intensity levels lost per frame, 3.5 per second for every unit of the speed
+    m_fadeStep = (std::uint8_t) std::clamp(speed * 3.5 / TIMER_FREQ, 1.0, 255.0);
+}
+
+void DisplayRenderer::enableGrid(bool enable) {
+    m_enableGrid = enable;
+}
+
+void DisplayRenderer::enableFade(bool enable) {
+    m_enableFade = enable;
+
+    if (!enable) {
+        m_intensity.fill(0);
+        m_dirtyRows = ~std::uint64_t(0);
+        m_glowing = false;
+    }
+}
+
+int DisplayRenderer::scaleFactor() const {
+    return m_scaleFactor;
+}
+
+Color DisplayRenderer::offColor() const {
+    return m_offColor;
+}
+
+Color DisplayRenderer::onColor() const {
+    return m_onColor;
+}
+
+bool DisplayRenderer::gridEnabled() const {
+    return m_enableGrid;
+}
+
+bool DisplayRenderer::fadeEnabled() const {
+    return m_enableFade;
+}
+
+void DisplayRenderer::convertRow(std::size_t y) {
+    std::uint32_t on = m_ramp[255];
+    const auto &line = m_frame[y];
+    const std::uint8_t *intensity = &m_intensity[y * (std::size_t) TEXTURE_SIZE.x];
+    std::uint32_t *row = &m_pixels[y * (std::size_t) TEXTURE_SIZE.x];
+
+    for (std::size_t x = 0; x < (std::size_t) m_size.x; ++x) {
+        row[x] = Display::pixel(line, x) ? on : m_ramp[intensity[x]];
+    }
+}
+
+void DisplayRenderer::fadePixels(std::uint64_t frames) {
+    auto step = (std::uint8_t) std::min<std::uint64_t>(m_fadeStep * frames, 255);
+    bool anyGlowing = false;
+
+    for (std::size_t y = 0; y < (std::size_t) m_size.y; ++y) {
+        std::uint8_t *intensity = &m_intensity[y * (std::size_t) TEXTURE_SIZE.x];
+        std::uint8_t glowing = 0;
+
+        // Written to be vectorized by the compiler: a saturating subtraction and an OR over a row of bytes
+        for (std::size_t x = 0; x < (std::size_t) TEXTURE_SIZE.x; ++x) {
+            std::uint8_t value = intensity[x];
+
+            glowing |= value;
+            intensity[x] = (std::uint8_t) (value > step ? value - step : 0);
+        }
+
+        if (glowing) {
+            m_dirtyRows |= std::uint64_t(1) << y;
+            anyGlowing = true;
+        }
+    }
+
+    m_glowing = anyGlowing;
+}
+
+void DisplayRenderer::updateRamp() {
+    auto lerp = [](std::uint8_t from, std::uint8_t to, unsigned i) {
+        return (std::uint8_t) ((from * (255 - i) + to * i + 127) / 255);
+    };
+
+    for (unsigned i = 0; i < m_ramp.size(); ++i) {
+        Color color = {
+            lerp(m_offColor.r, m_onColor.r, i), lerp(m_offColor.g, m_onColor.g, i),
+            lerp(m_offColor.b, m_onColor.b, i), lerp(m_offColor.a, m_onColor.a, i)
+        };
+
+        m_ramp[i] = toRGBA8888(color);
+    }
+}
+
+void DisplayRenderer::buildGrid() {
+    m_renderer.SetTarget(m_grid);
+
+    m_renderer.SetDrawColor(0x00, 0x00, 0x00, 0x00);
+    m_renderer.Clear();
+
+    auto &rects = m_gridRects[0];
+    rects.clear();
+
+    for (int y = 0; y < m_size.y; ++y) {
+        for (int x = 0; x < m_size.x; ++x) {
+            rects.emplace_back(toSDL(Point { x, y } * m_pixelSize), toSDL(m_pixelSize));
+        }
+    }
+
+    m_renderer.SetDrawColor(0xff, 0xff, 0xff, 0xff);
+    m_renderer.DrawRects(rects.data(), (int) rects.size());
+
+    m_renderer.SetTarget();
+
+    m_gridBuilt = true;
+}
+
+void DisplayRenderer::drawGridOutlines() {
+    for (auto &rects : m_gridRects) {
+        rects.clear();
+    }
+
+    for (std::size_t y = 0; y < (std::size_t) m_size.y; ++y) {
+        for (std::size_t x = 0; x < (std::size_t) m_size.x; ++x) {
+            Point pos = { (int) x, (int) y };
+
+            m_gridRects[Display::pixel(m_frame[y], x)].emplace_back(toSDL(pos * m_pixelSize), toSDL(m_pixelSize));
+        }
+    }
+
+    // Color of the grid is the inverted color of pixel (except for its alpha channel)
+    const Color colors[] = { m_offColor, m_onColor };
+
+    for (std::size_t i = 0; i < 2; ++i) {
+        Color color = colors[i];
+        color.r = (std::uint8_t) ~color.r;
+        color.g = (std::uint8_t) ~color.g;
+        color.b = (std::uint8_t) ~color.b;
+
+        m_renderer.SetDrawColor(toSDL(color));
+        m_renderer.DrawRects(m_gridRects[i].data(), (int) m_gridRects[i].size());
+    }
+}
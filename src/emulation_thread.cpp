@@ -0,0 +1,79 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#include <nchip8/emulation_thread.hpp>
+
+using namespace nchip8;
+
+EmulationThread::EmulationThread(VM &vm, Frame frame)
+    : m_vm    { vm },
+      m_frame { std::move(frame) } {
+    m_thread = std::thread(&EmulationThread::run, this);
+}
+
+EmulationThread::~EmulationThread() {
+    m_stop = true;
+    m_thread.join();
+}
+
+EmulationThread::Lock::Lock(EmulationThread &thread)
+    : m_thread { thread },
+      m_lock   { thread.m_mutex } {
+}
+
+EmulationThread::Lock::~Lock() {
+    m_thread.publish();
+}
+
+EmulationThread::Lock EmulationThread::lock() {
+    return Lock(*this);
+}
+
+const EmulationThread::Snapshot &EmulationThread::snapshot() {
+    m_snapshots.update();
+
+    return m_snapshots.front();
+}
+
+void EmulationThread::publish() {
+    Snapshot &snapshot = m_snapshots.back();
+
+    snapshot.state        = m_vm.state;
+    snapshot.mode         = m_vm.mode();
+    snapshot.recording    = m_vm.recording();
+    snapshot.playingBack  = m_vm.playingBack();
+    snapshot.runAheadTime = m_vm.runAheadTime();
+
+    m_snapshots.publish();
+}
+
+void EmulationThread::run() {
+    using Clock = std::chrono::steady_clock;
+
+    constexpr auto FRAME_DURATION = std::chrono::nanoseconds(1'000'000'000 / TIMER_FREQ);
+    // The only catch-up policy: frames that are late are run back to back, but after a longer stall (e.g. the process
+    // was stopped) the lost frames aren't caught up in a burst
+    constexpr auto MAX_LAG = 4 * FRAME_DURATION;
+
+    // An absolute deadline doesn't drift, however long the frames and the wakeups take
+    Clock::time_point deadline = Clock::now();
+
+    while (!m_stop) {
+        {
+            std::lock_guard lock(m_mutex);
+
+            m_frame(deadline);
+            publish();
+        }
+
+        deadline += FRAME_DURATION;
+
+        Clock::time_point now = Clock::now();
+
+        if (now - deadline > MAX_LAG) {
+            deadline = now;
+        }
+
+        std::this_thread::sleep_until(deadline);
+    }
+}
@@ -3,7 +3,6 @@
 
 #include <nchip8/instr_set.hpp>
 
-#include <cstdlib>
 #include <cstring>
 #include <limits>
 
@@ -15,121 +14,102 @@ namespace {
     };
 }
 
-void instr_set_impls::clearScreen_impl(VM &vm, std::uint16_t opcode) {
-    (void) opcode;
+void instr_set_impls::clearScreen_impl(VM &vm, const OperandMap &ops) {
+    (void) ops;
 
     vm.display.clear();
 }
 
-void instr_set_impls::ret_impl(VM &vm, std::uint16_t opcode) {
-    (void) opcode;
+void instr_set_impls::ret_impl(VM &vm, const OperandMap &ops) {
+    (void) ops;
 
-    auto &stack = vm.state.stack;
+    auto &state = vm.state;
 
-    std::uint16_t addr = stack.top();
-    stack.pop();
-    vm.state.pc = addr;
-}
+    if (state.sp == 0) {
+        throw StackUnderflow();
+    }
 
-void instr_set_impls::jump_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
+    state.pc = state.stack[--state.sp];
+}
 
+void instr_set_impls::jump_impl(VM &vm, const OperandMap &ops) {
     vm.state.pc = ops.addr;
 }
 
-void instr_set_impls::call_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
-    auto &stack = vm.state.stack;
+void instr_set_impls::call_impl(VM &vm, const OperandMap &ops) {
+    auto &state = vm.state;
 
-    if (stack.size() >= STACK_MAX_SIZE) {
+    if (state.sp >= STACK_MAX_SIZE) {
         throw StackOverflow();
     }
 
-    stack.push(vm.state.pc);
-    vm.state.pc = ops.addr;
+    state.stack[state.sp++] = state.pc;
+    state.pc = ops.addr;
 }
 
-void instr_set_impls::skipEqual_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::skipEqual_impl(VM &vm, const OperandMap &ops) {
     if (vm.state.regs[ops.x] == ops.imm2) {
         vm.state.pc += 2;
     }
 }
 
-void instr_set_impls::skipNotEqual_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::skipNotEqual_impl(VM &vm, const OperandMap &ops) {
     if (vm.state.regs[ops.x] != ops.imm2) {
         vm.state.pc += 2;
     }
 }
 
-void instr_set_impls::skipRegsEqual_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::skipRegsEqual_impl(VM &vm, const OperandMap &ops) {
     if (vm.state.regs[ops.x] == vm.state.regs[ops.y]) {
         vm.state.pc += 2;
     }
 }
 
-void instr_set_impls::loadByte_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::loadByte_impl(VM &vm, const OperandMap &ops) {
     vm.state.regs[ops.x] = ops.imm2;
 }
 
-void instr_set_impls::add_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::add_impl(VM &vm, const OperandMap &ops) {
     vm.state.regs[ops.x] += ops.imm2;
 }
 
-void instr_set_impls::loadReg_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::loadReg_impl(VM &vm, const OperandMap &ops) {
     vm.state.regs[ops.x] = vm.state.regs[ops.y];
 }
 
-void instr_set_impls::or_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
-    if (vm.quirks.bitwiseResetVF) {
+template <bool ResetVF>
+void instr_set_impls::or_impl(VM &vm, const OperandMap &ops) {
+    if constexpr (ResetVF) {
         vm.state.regs[0xf] = 0;
     }
 
     vm.state.regs[ops.x] |= vm.state.regs[ops.y];
 }
 
-void instr_set_impls::and_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
-    if (vm.quirks.bitwiseResetVF) {
+template <bool ResetVF>
+void instr_set_impls::and_impl(VM &vm, const OperandMap &ops) {
+    if constexpr (ResetVF) {
         vm.state.regs[0xf] = 0;
     }
 
     vm.state.regs[ops.x] &= vm.state.regs[ops.y];
 }
 
-void instr_set_impls::xor_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
-    if (vm.quirks.bitwiseResetVF) {
+template <bool ResetVF>
+void instr_set_impls::xor_impl(VM &vm, const OperandMap &ops) {
+    if constexpr (ResetVF) {
         vm.state.regs[0xf] = 0;
     }
 
     vm.state.regs[ops.x] ^= vm.state.regs[ops.y];
 }
 
-void instr_set_impls::addReg_impl(VM &vm, std::uint16_t opcode) {
+void instr_set_impls::addReg_impl(VM &vm, const OperandMap &ops) {
     auto willOverflow = [](std::uint8_t addend1, std::uint8_t addend2) -> bool {
         // See https://stackoverflow.com/a/1514309/12537826
         return addend2 > 0 && addend1 > std::numeric_limits<std::uint8_t>::max() - addend2;
     };
 
-    OperandMap ops(opcode);
-
     std::uint8_t &vx = vm.state.regs[ops.x];
     std::uint8_t  vy = vm.state.regs[ops.y];
 
@@ -140,9 +120,7 @@ void instr_set_impls::addReg_impl(VM &vm, std::uint16_t opcode) {
     vm.state.regs[0xf] = overflow;
 }
 
-void instr_set_impls::subReg_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::subReg_impl(VM &vm, const OperandMap &ops) {
     std::uint8_t &vx = vm.state.regs[ops.x];
     std::uint8_t  vy = vm.state.regs[ops.y];
 
@@ -153,16 +131,15 @@ void instr_set_impls::subReg_impl(VM &vm, std::uint16_t opcode) {
     vm.state.regs[0xf] = !underflow;
 }
 
-void instr_set_impls::rshift_impl(VM &vm, std::uint16_t opcode) {
+template <bool ShiftVY>
+void instr_set_impls::rshift_impl(VM &vm, const OperandMap &ops) {
     auto leastSignificantBit = [](std::uint8_t num) -> std::uint8_t {
         return num & 0b1;
     };
 
-    OperandMap ops(opcode);
-
     std::uint8_t &vx = vm.state.regs[ops.x];
 
-    if (vm.quirks.shiftSetVxToVy) {
+    if constexpr (ShiftVY) {
         std::uint8_t vy = vm.state.regs[ops.y];
         vx = vy;
     }
@@ -173,9 +150,7 @@ void instr_set_impls::rshift_impl(VM &vm, std::uint16_t opcode) {
     vm.state.regs[0xf] = lsb;
 }
 
-void instr_set_impls::loadAndSubReg_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::loadAndSubReg_impl(VM &vm, const OperandMap &ops) {
     std::uint8_t &vx = vm.state.regs[ops.x];
     std::uint8_t  vy = vm.state.regs[ops.y];
 
@@ -186,16 +161,15 @@ void instr_set_impls::loadAndSubReg_impl(VM &vm, std::uint16_t opcode) {
     vm.state.regs[0xf] = !underflow;
 }
 
-void instr_set_impls::lshift_impl(VM &vm, std::uint16_t opcode) {
+template <bool ShiftVY>
+void instr_set_impls::lshift_impl(VM &vm, const OperandMap &ops) {
     auto mostSignificantBit = [](std::uint8_t num) -> std::uint8_t {
         return (num >> (sizeof(num) * 8 - 1)) & 0b1;
     };
 
-    OperandMap ops(opcode);
-
     std::uint8_t &vx = vm.state.regs[ops.x];
 
-    if (vm.quirks.shiftSetVxToVy) {
+    if constexpr (ShiftVY) {
         std::uint8_t vy = vm.state.regs[ops.y];
         vx = vy;
     }
@@ -206,26 +180,21 @@ void instr_set_impls::lshift_impl(VM &vm, std::uint16_t opcode) {
     vm.state.regs[0xf] = msb;
 }
 
-void instr_set_impls::skipRegsNotEqual_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::skipRegsNotEqual_impl(VM &vm, const OperandMap &ops) {
     if (vm.state.regs[ops.x] != vm.state.regs[ops.y]) {
         vm.state.pc += 2;
     }
 }
 
-void instr_set_impls::loadI_impl(VM &vm, std::uint16_t opcode) {
-    std::uint16_t addr = opcode & 0x0fff;
-
-    vm.state.i = addr;
+void instr_set_impls::loadI_impl(VM &vm, const OperandMap &ops) {
+    vm.state.i = ops.imm3;
 }
 
-void instr_set_impls::jumpOffset_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+template <bool UseV0>
+void instr_set_impls::jumpOffset_impl(VM &vm, const OperandMap &ops) {
     std::uint8_t offset;
 
-    if (vm.quirks.jumpOffsetUseV0) {
+    if constexpr (UseV0) {
         offset = vm.state.regs[0];
     } else {
         offset = vm.state.regs[ops.x];
@@ -234,90 +203,92 @@ void instr_set_impls::jumpOffset_impl(VM &vm, std::uint16_t opcode) {
     vm.state.pc = ops.addr + offset;
 }
 
-void instr_set_impls::random_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
-    vm.state.regs[ops.x] = std::rand() & ops.imm2;
+void instr_set_impls::random_impl(VM &vm, const OperandMap &ops) {
+    vm.state.regs[ops.x] = vm.state.rng.next() & ops.imm2;
 }
 
-void instr_set_impls::drawSprite_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
+template <Extension Ext, bool Draw8x16InLores, bool CountCollidedRows>
+void instr_set_impls::drawSprite_impl(VM &vm, const OperandMap &ops) {
     std::uint8_t height = ops.imm1;
 
     bool hires = height == 0;
 
-    if (vm.ext() == Extension::NONE && hires) {
-        return;
+    if constexpr (Ext == Extension::NONE) {
+        if (hires) {
+            return;
+        }
     }
 
     Sprite sprite;
 
-    sdl::Point dispSize = vm.display.size();
+    Point dispSize = vm.display.size();
     sprite.pos = { vm.state.regs[ops.x] % dispSize.x, vm.state.regs[ops.y] % dispSize.y };
     
     if (hires) {
-        sprite.width = (vm.display.res() == Resolution::LOW && vm.quirks.draw8x16SpriteInLores) ? 8 : 16;
+        sprite.width = (Draw8x16InLores && vm.display.res() == Resolution::LOW) ? 8 : 16;
+        sprite.height = 16;
 
-        for (std::size_t i = 0; i < 32; i += 2) {
-            std::uint16_t msb = (std::uint16_t) (vm.state.memory[vm.state.i + i] << 8);
-            std::uint16_t lsb = vm.state.memory[vm.state.i + i + 1];
+        for (std::size_t i = 0; i < 16; ++i) {
+            std::uint16_t msb = (std::uint16_t) (vm.state.memory[vm.state.i + i * 2] << 8);
+            std::uint16_t lsb = vm.state.memory[vm.state.i + i * 2 + 1];
 
-            sprite.pixels.push_back(msb | lsb);
+            sprite.rows[i] = msb | lsb;
         }
     } else {
         sprite.width = 8;
+        sprite.height = height;
 
         for (std::size_t i = 0; i < height; ++i) {
-            sprite.pixels.push_back(vm.state.memory[vm.state.i + i]);
+            sprite.rows[i] = vm.state.memory[vm.state.i + i];
         }
     }
 
-    bool collided = vm.display.drawSprite(sprite);
-    vm.state.regs[0xf] = collided;
-}
+    SpriteCollision collision = vm.display.drawSprite(sprite);
+
+    // SCHIP 1.1 sets VF in hires to the number of the rows that collided or were clipped at the bottom
+    if constexpr (CountCollidedRows) {
+        if (vm.display.res() == Resolution::HIGH) {
+            vm.state.regs[0xf] = (std::uint8_t) (collision.collidedRows + collision.clippedRows);
 
-void instr_set_impls::skipPressed_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
+            return;
+        }
+    }
+
+    vm.state.regs[0xf] = collision.collidedRows > 0;
+}
 
-    const auto &inputTable = vm.state.inputTable;
+void instr_set_impls::skipPressed_impl(VM &vm, const OperandMap &ops) {
     auto key = vm.state.regs[ops.x];
 
-    if (inputTable[key]) {
+    if (vm.state.keyPressed(key)) {
         vm.state.pc += 2;
     }
 }
 
-void instr_set_impls::skipNotPressed_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
-    const auto &inputTable = vm.state.inputTable;
+void instr_set_impls::skipNotPressed_impl(VM &vm, const OperandMap &ops) {
     auto key = vm.state.regs[ops.x];
 
-    if (!inputTable[key]) {
+    if (!vm.state.keyPressed(key)) {
         vm.state.pc += 2;
     }
 }
 
-void instr_set_impls::loadDT_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::loadDT_impl(VM &vm, const OperandMap &ops) {
     vm.state.regs[ops.x] = vm.state.dt;
 }
 
-void instr_set_impls::readKey_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
-    const auto &table = vm.state.inputTable;
+void instr_set_impls::readKey_impl(VM &vm, const OperandMap &ops) {
+    const auto &state = vm.state;
 
-    for (std::size_t i = 0; i < table.size(); ++i) {
-        if (table[i]) {
+    for (std::size_t i = 0; i < KEY_COUNT; ++i) {
+        if (state.keyPressed(i)) {
             vm.keyToRelease = i;
             vm.waitForKeyRelease = true;
 
             break;
         }
 
-        if (vm.waitForKeyRelease && !table[vm.keyToRelease]) {
+        if (vm.waitForKeyRelease && !state.keyPressed(vm.keyToRelease)) {
             vm.state.regs[ops.x] = (std::uint8_t) vm.keyToRelease;
             vm.waitForKeyRelease = false;
 
@@ -328,34 +299,24 @@ void instr_set_impls::readKey_impl(VM &vm, std::uint16_t opcode) {
     vm.state.pc -= 2;
 }
 
-void instr_set_impls::setDT_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::setDT_impl(VM &vm, const OperandMap &ops) {
     vm.state.dt = vm.state.regs[ops.x];
 }
 
-void instr_set_impls::setST_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::setST_impl(VM &vm, const OperandMap &ops) {
     vm.state.st = vm.state.regs[ops.x];
 }
 
-void instr_set_impls::addI_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::addI_impl(VM &vm, const OperandMap &ops) {
     vm.state.i += vm.state.regs[ops.x];
 }
 
-void instr_set_impls::fontChar_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::fontChar_impl(VM &vm, const OperandMap &ops) {
     std::uint8_t vx = vm.state.regs[ops.x];
     vm.state.i = FONT_OFFSET + vx * FONT_CHAR_SIZE.y;
 }
 
-void instr_set_impls::bcd_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::bcd_impl(VM &vm, const OperandMap &ops) {
     auto bcd = [](std::uint16_t num, int digit) -> std::uint8_t {
         for (int i = 1; i < digit; ++i) {
             num /= 10;
@@ -371,11 +332,12 @@ void instr_set_impls::bcd_impl(VM &vm, std::uint16_t opcode) {
     memory[i + 0] = bcd(vx, 3); // hundreds digit
     memory[i + 1] = bcd(vx, 2); // tens digit
     memory[i + 2] = bcd(vx, 1); // ones digit
-}
 
-void instr_set_impls::regDump_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
+    vm.memoryChanged(i, 3);
+}
 
+template <bool IncrementI>
+void instr_set_impls::regDump_impl(VM &vm, const OperandMap &ops) {
     const auto &regs = vm.state.regs;
     auto &regI = vm.state.i;
 
@@ -383,14 +345,15 @@ void instr_set_impls::regDump_impl(VM &vm, std::uint16_t opcode) {
         vm.state.memory[regI + i] = regs[i];
     }
 
-    if (vm.quirks.loadSaveIncrementI) {
+    vm.memoryChanged(regI, ops.x + 1);
+
+    if constexpr (IncrementI) {
         regI += ops.x + 1;
     }
 }
 
-void instr_set_impls::regLoad_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+template <bool IncrementI>
+void instr_set_impls::regLoad_impl(VM &vm, const OperandMap &ops) {
     auto &regs = vm.state.regs;
     auto &regI = vm.state.i;
 
@@ -398,82 +361,107 @@ void instr_set_impls::regLoad_impl(VM &vm, std::uint16_t opcode) {
         regs[i] = vm.state.memory[regI + i];
     }
 
-    if (vm.quirks.loadSaveIncrementI) {
+    if constexpr (IncrementI) {
         regI += ops.x + 1;
     }
 }
 
-void instr_set_impls::hires_impl(VM &vm, std::uint16_t opcode) {
-    (void) opcode;
+void instr_set_impls::hires_impl(VM &vm, const OperandMap &ops) {
+    (void) ops;
 
     vm.display.setResolution(Resolution::HIGH);
 }
 
-void instr_set_impls::lores_impl(VM &vm, std::uint16_t opcode) {
-    (void) opcode;
+void instr_set_impls::lores_impl(VM &vm, const OperandMap &ops) {
+    (void) ops;
 
     vm.display.setResolution(Resolution::LOW);
 }
 
-void instr_set_impls::scrollDown_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::scrollDown_impl(VM &vm, const OperandMap &ops) {
     vm.display.scroll(ScrollDirection::DOWN, ops.imm1);
 }
 
-void instr_set_impls::scrollRight_impl(VM &vm, std::uint16_t opcode) {
-    (void) opcode;
+void instr_set_impls::scrollRight_impl(VM &vm, const OperandMap &ops) {
+    (void) ops;
 
     vm.display.scroll(ScrollDirection::RIGHT, 4);
 }
 
-void instr_set_impls::scrollLeft_impl(VM &vm, std::uint16_t opcode) {
-    (void) opcode;
+void instr_set_impls::scrollLeft_impl(VM &vm, const OperandMap &ops) {
+    (void) ops;
 
     vm.display.scroll(ScrollDirection::LEFT, 4);
 }
 
-void instr_set_impls::bigFontChar_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::bigFontChar_impl(VM &vm, const OperandMap &ops) {
     std::uint8_t vx = vm.state.regs[ops.x];
     vm.state.i = BIG_FONT_OFFSET + vx * BIG_FONT_CHAR_SIZE.y;
 }
 
-void instr_set_impls::saveFlags_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::saveFlags_impl(VM &vm, const OperandMap &ops) {
     if (ops.x > 7) {
         throw VMError("the X should be <= 7, there are only 8 persistent flags");
     }
 
     std::array<std::uint8_t, 8> flags;
-    std::memcpy(flags.data(), &vm.cfg.cpu.rplFlags, sizeof(std::uint64_t));
+    std::memcpy(flags.data(), &vm.state.rplFlags, sizeof(std::uint64_t));
 
     for (std::size_t i = 0; i < ops.x; ++i) {
         flags[i] = vm.state.regs[i];
     }
 
-    std::memcpy(&vm.cfg.cpu.rplFlags, flags.data(), sizeof(std::uint64_t));
+    std::memcpy(&vm.state.rplFlags, flags.data(), sizeof(std::uint64_t));
 }
 
-void instr_set_impls::loadFlags_impl(VM &vm, std::uint16_t opcode) {
-    OperandMap ops(opcode);
-
+void instr_set_impls::loadFlags_impl(VM &vm, const OperandMap &ops) {
     if (ops.x > 7) {
         throw VMError("the X should be <= 7, there are only 8 persistent flags");
     }
 
     std::array<std::uint8_t, 8> flags;
-    std::memcpy(flags.data(), &vm.cfg.cpu.rplFlags, sizeof(std::uint64_t));
+    std::memcpy(flags.data(), &vm.state.rplFlags, sizeof(std::uint64_t));
 
     for (std::size_t i = 0; i < ops.x; ++i) {
         vm.state.regs[i] = flags[i];
     }
 }
 
-void instr_set_impls::exit_impl(VM &vm, std::uint16_t opcode) {
-    (void) opcode;
+void instr_set_impls::exit_impl(VM &vm, const OperandMap &ops) {
+    (void) ops;
 
     vm.unload();
 }
+
+void instr_set_impls::invalidOpcode_impl(VM &vm, const OperandMap &ops) {
+    std::uint16_t offset = vm.state.pc > 0 ? vm.state.pc - 2 : 0;
+
+    throw InvalidOpcode(ops.opcode, offset);
+}
+
+// The dispatch tables pick one of these for every quirk profile
+namespace nchip8::instr_set_impls {
+#define INSTANTIATE(_name, ...) template void _name##_impl<__VA_ARGS__>(VM &vm, const OperandMap &ops)
+    INSTANTIATE(or, false);
+    INSTANTIATE(or, true);
+    INSTANTIATE(and, false);
+    INSTANTIATE(and, true);
+    INSTANTIATE(xor, false);
+    INSTANTIATE(xor, true);
+    INSTANTIATE(rshift, false);
+    INSTANTIATE(rshift, true);
+    INSTANTIATE(lshift, false);
+    INSTANTIATE(lshift, true);
+    INSTANTIATE(jumpOffset, false);
+    INSTANTIATE(jumpOffset, true);
+    INSTANTIATE(drawSprite, Extension::NONE, false, false);
+    INSTANTIATE(drawSprite, Extension::SCHIP, false, false);
+    INSTANTIATE(drawSprite, Extension::SCHIP, false, true);
+    INSTANTIATE(drawSprite, Extension::SCHIP, true, false);
+    INSTANTIATE(drawSprite, Extension::SCHIP, true, true);
+    INSTANTIATE(regDump, false);
+    INSTANTIATE(regDump, true);
+    INSTANTIATE(regLoad, false);
+    INSTANTIATE(regLoad, true);
+#undef INSTANTIATE
+}
@@ -97,7 +97,8 @@ std::string nchip8::instrKindToString(InstrKind kind) {
 }
 
 OperandMap::OperandMap(std::uint16_t opcode)
-    : x    { (uint8_t)  ((opcode & 0x0f00) >> 8) },
+    : opcode { opcode },
+      x    { (uint8_t)  ((opcode & 0x0f00) >> 8) },
       y    { (uint8_t)  ((opcode & 0x00f0) >> 4) },
       addr { (uint16_t)  (opcode & 0x0fff) },
       imm1 { (uint8_t)   (opcode & 0x000f) },
@@ -13,11 +13,13 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <chrono>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <optional>
+#include <thread>
 
 using namespace nchip8;
 namespace fs = std::filesystem;
@@ -26,47 +28,70 @@ MainApplication::MainApplication()
     : m_cfg { readConfig() },
       m_window { "nCHIP-8 v" + VERSION, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, m_cfg.graphics.windowSize.x,
           m_cfg.graphics.windowSize.y, SDL_WINDOW_ALLOW_HIGHDPI },
-      m_renderer { m_window, -1, SDL_RENDERER_ACCELERATED },
-      m_display { m_renderer },
-      m_vm { m_display, m_cfg },
-      m_ui { m_window, m_renderer, m_vm } {
-    std::srand(m_cfg.cpu.rngSeed);
-
-    m_display.setScaleFactor(m_cfg.graphics.scaleFactor);
-    m_display.setOffColor(m_cfg.graphics.offColor);
-    m_display.setOnColor(m_cfg.graphics.onColor);
-    m_display.enableFade(m_cfg.graphics.enableFade);
-    m_display.setFadeSpeed(m_cfg.cpu.cyclesPerSec);
-    m_display.wrapPixelsX = m_vm.quirks.wrapPixelsX;
-    m_display.wrapPixelsY = m_vm.quirks.wrapPixelsY;
+      m_renderer { m_window, -1, SDL_RENDERER_ACCELERATED | (m_cfg.graphics.vsync ? SDL_RENDERER_PRESENTVSYNC : 0u) },
+      m_displayRenderer { m_renderer },
+      m_audioOutput { m_cfg.sound },
+      m_vm { m_cfg.cpu },
+      m_ui { m_window, m_renderer, m_cfg, m_vm, m_displayRenderer, m_audioOutput, m_emulation },
+      m_emulation { m_vm, [this](auto frameEnd) { emulateFrame(frameEnd); } } {
+    // The emulation thread is already running
+    auto lock = m_emulation.lock();
+
+    m_vm.displaySink = &m_displayRenderer;
+    m_vm.audioSink = &m_audioOutput;
+
+    m_displayRenderer.setScaleFactor(m_cfg.graphics.scaleFactor);
+    m_displayRenderer.setOffColor(m_cfg.graphics.offColor);
+    m_displayRenderer.setOnColor(m_cfg.graphics.onColor);
+    m_displayRenderer.enableFade(m_cfg.graphics.enableFade);
+    m_displayRenderer.setFadeSpeed(m_cfg.cpu.cyclesPerSec);
+    m_vm.display.wrapPixelsX = m_vm.quirks().wrapPixelsX;
+    m_vm.display.wrapPixelsY = m_vm.quirks().wrapPixelsY;
+
+    // The driver may not support vsync, then the frame cap is used instead
+    SDL_RendererInfo info;
+    m_vsync = SDL_GetRendererInfo(m_renderer.Get(), &info) == 0 && info.flags & SDL_RENDERER_PRESENTVSYNC;
 }
 
 void MainApplication::update() {
-    auto handleEvents = [this]() {
-        SDL_Event event;
-
-        while (SDL_PollEvent(&event)) {
-            ImGui_ImplSDL2_ProcessEvent(&event);
-
-            if (event.type == SDL_QUIT || (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE)) {
-                m_quit = true;
-            } else if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
-                if (!m_ui.wantCaptureKeyboard()) {
-                    m_vm.updateInputTable(event);
-                }
+    auto handleEvent = [this](SDL_Event &event) {
+        if (event.type == m_wakeEvent) {
+            m_wakePending = false;
+
+            return;
+        }
+
+        m_busyUntil = Clock::now() + BUSY_TIME;
+
+        ImGui_ImplSDL2_ProcessEvent(&event);
+
+        if (event.type == SDL_QUIT || (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE)) {
+            m_quit = true;
+        } else if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
+            if (!m_ui.wantCaptureKeyboard()) {
+                handleKey(event.key);
             }
         }
     };
 
-    handleEvents();
+    SDL_Event event;
 
-    try {
-        m_vm.update();
-    } catch (const VMError &err) {
-        m_ui.showError(err.what());
+    // With nothing to animate, the thread sleeps until there is an event. The emulation sends one when it has
+    // something new to show (see emulateFrame()), so a paused VM or a game waiting for a key costs nothing.
+    if (Clock::now() >= m_busyUntil && SDL_WaitEventTimeout(&event, IDLE_TIMEOUT_MS)) {
+        handleEvent(event);
+    }
+
+    limitFrameRate();
+
+    while (SDL_PollEvent(&event)) {
+        handleEvent(event);
     }
 
-    m_display.prepare();
+    const std::uint8_t *keyboard = SDL_GetKeyboardState(nullptr);
+    m_rewindHeld = keyboard[REWIND_KEY] && !m_ui.wantCaptureKeyboard();
+
+    m_displayRenderer.prepare();
     m_ui.update();
 
     if (m_ui.quitRequested()) {
@@ -78,16 +103,32 @@ void MainApplication::render() {
     m_renderer.SetDrawColor(0x0);
     m_renderer.Clear();
 
-    m_display.draw();
+    m_displayRenderer.draw();
     m_ui.render();
 
     m_renderer.Present();
 }
 
 void MainApplication::deinit() {
+    {
+        // The flags written by FX75 are kept for the next session
+        auto lock = m_emulation.lock();
+        m_cfg.cpu.rplFlags = m_vm.state.rplFlags;
+    }
+
     m_cfg.writeFile();
 }
 
+void MainApplication::startNetplay(const std::string &rom, const std::string &localSocket,
+                                   const std::string &remoteSocket) {
+    auto lock = m_emulation.lock();
+
+    m_vm.loadFile(rom);
+    m_vm.setMode(VMMode::RUN);
+
+    m_netplay = std::make_unique<NetplaySession>(m_vm, localSocket, remoteSocket);
+}
+
 Config MainApplication::readConfig() {
     auto getHomeDirPath = []() -> std::optional<std::string> {
         const char *home = std::getenv("HOME");
@@ -127,14 +168,114 @@ Config MainApplication::readConfig() {
     return Config(path);
 }
 
-int main() {
+void MainApplication::handleKey(const SDL_KeyboardEvent &event) {
+    const auto &keysym = event.keysym;
+
+    if (keysym.mod != KMOD_NONE || event.repeat) {
+        return;
+    }
+
+    if (m_keyMapLayout != m_cfg.input.layout) {
+        m_keyMap = makeKeyMap(m_cfg.input.layout);
+        m_keyMapLayout = m_cfg.input.layout;
+    }
+
+    if (keysym.scancode < 0 || keysym.scancode >= SDL_NUM_SCANCODES || m_keyMap[(std::size_t) keysym.scancode] < 0) {
+        return;
+    }
+
+    auto key = (std::size_t) m_keyMap[(std::size_t) keysym.scancode];
+    bool pressed = event.type == SDL_KEYDOWN;
+
+    if (m_netplay) {
+        auto lock = m_emulation.lock();
+        m_netplay->setKey(key, pressed);
+
+        return;
+    }
+
+    // The event timestamp is in the milliseconds of SDL_GetTicks(), so the age is used to place it on the VM clock.
+    // The VM applies the key at the cycle matching that time instead of at the next frame boundary.
+    auto age = std::chrono::milliseconds(SDL_GetTicks() - event.timestamp);
+    m_vm.queueKey(key, pressed, std::chrono::steady_clock::now() - age);
+}
+
+void MainApplication::emulateFrame(std::chrono::steady_clock::time_point frameEnd) {
+    VMMode mode = m_vm.mode();
+
+    // The thread keeps the frame rate, so this runs exactly one frame (the VM's and the session's own pacing in
+    // update() would make it 0 or 2 frames every other tick)
+    try {
+        if (m_netplay) {
+            // Rewinding would desynchronize the sides. While the session waits for the other side, the frame is
+            // skipped.
+            if (m_vm.mode() == VMMode::RUN) {
+                m_netplay->runFrame();
+            }
+        } else if (m_rewindHeld && m_vm.mode() == VMMode::RUN) {
+            // One frame back per emulated frame; when the history runs out, the game just stays at its oldest frame
+            m_vm.rewind();
+        } else {
+            m_vm.runFrame(frameEnd);
+        }
+    } catch (const VMError &err) {
+        m_ui.showError(err.what());
+        wakeUp();
+    }
+
+    // The snapshot read by the debug windows changes every frame
+    if (m_displayRenderer.takeChanged() || m_vm.mode() != mode || m_ui.followsEmulation()) {
+        wakeUp();
+    }
+}
+
+void MainApplication::wakeUp() {
+    if (m_wakePending.exchange(true)) {
+        return;
+    }
+
+    SDL_Event event {};
+    event.type = m_wakeEvent;
+
+    SDL_PushEvent(&event);
+}
+
+void MainApplication::limitFrameRate() {
+    if (m_vsync || m_cfg.graphics.frameCap <= 0) {
+        return;
+    }
+
+    auto frameLength = std::chrono::nanoseconds(1'000'000'000 / m_cfg.graphics.frameCap);
+
+    std::this_thread::sleep_until(m_lastFrame + frameLength);
+    m_lastFrame = Clock::now();
+}
+
+int main(int argc, char **argv) {
+    bool netplay = argc == 5 && std::string(argv[1]) == "--netplay";
+
+    if (argc > 1 && !netplay) {
+        std::cerr << "Usage: nchip8 [--netplay <local socket> <remote socket> <ROM>]\n";
+
+        return EXIT_FAILURE;
+    }
+
     sdl::SDL sdl(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER);
 
     try {
         MainApplication app;
+
+        if (netplay) {
+            app.startNetplay(argv[4], argv[2], argv[3]);
+        }
+
         app.run();
     } catch (const toml::syntax_error &e) {
         std::cerr << e.what() << '\n';
+    } catch (const std::runtime_error &e) {
+        std::cerr << "nchip8: " << e.what() << '\n';
+
+        return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
@@ -0,0 +1,100 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#include <nchip8/movie.hpp>
+#include <nchip8/binary_io.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+using namespace nchip8;
+
+// The file format (all integers are little-endian):
+//
+//   u32 magic, u32 version, u64 ROM hash, u8 extension, u8 quirk bits, u32 PRNG seed, u32 cycles per second,
+//   u64 RPL flags, u64 frame count, u64 final display hash, u64 event count,
+//
+// followed by the events. Every event is the number of instructions since the previous event as a LEB128 varint and
+// a byte with the key in the lower nibble and the pressed flag in the highest bit. So an event usually takes 2-3
+// bytes.
+namespace {
+    constexpr std::uint8_t PRESSED_BIT = 0x80;
+}
+
+MovieError::MovieError(const std::string &err)
+    : VMError { err } {
+
+}
+
+Movie::Movie(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file) {
+        throw MovieError("file '" + path + "' cannot be opened. May not exist or may not have read permission");
+    }
+
+    std::vector<std::uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    ByteReader<MovieError> in(bytes, "the movie file");
+
+    if (in.u32() != MAGIC) {
+        throw MovieError("file '" + path + "' isn't an nCHIP-8 movie");
+    }
+
+    if (in.u32() != VERSION) {
+        throw MovieError("movie '" + path + "' was made by an incompatible version of nCHIP-8");
+    }
+
+    romHash          = in.u64();
+    ext              = (Extension) in.u8();
+    quirks           = unpackQuirks(in.u8());
+    rngSeed          = in.u32();
+    cyclesPerSec     = in.u32();
+    rplFlags         = in.u64();
+    frameCount       = in.u64();
+    finalDisplayHash = in.u64();
+
+    std::uint64_t eventCount = in.u64();
+    std::uint64_t cycle = 0;
+
+    // Don't trust the count for the reservation, a corrupted file could make us allocate gigabytes
+    events.reserve((std::size_t) std::min<std::uint64_t>(eventCount, bytes.size() / 2));
+
+    for (std::uint64_t i = 0; i < eventCount; ++i) {
+        cycle += in.varint();
+        std::uint8_t keyByte = in.u8();
+
+        events.push_back({ cycle, (std::uint8_t) (keyByte & 0x0f), (keyByte & PRESSED_BIT) != 0 });
+    }
+}
+
+void Movie::writeFile(const std::string &path) const {
+    ByteWriter out;
+
+    out.u32(MAGIC);
+    out.u32(VERSION);
+    out.u64(romHash);
+    out.u8((std::uint8_t) ext);
+    out.u8(packQuirks(quirks));
+    out.u32(rngSeed);
+    out.u32(cyclesPerSec);
+    out.u64(rplFlags);
+    out.u64(frameCount);
+    out.u64(finalDisplayHash);
+    out.u64(events.size());
+
+    std::uint64_t prevCycle = 0;
+
+    for (const auto &event : events) {
+        out.varint(event.cycle - prevCycle);
+        out.u8((std::uint8_t) (event.key | (event.pressed ? PRESSED_BIT : 0)));
+
+        prevCycle = event.cycle;
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+    if (!file.write((const char *) out.bytes.data(), (std::streamsize) out.bytes.size())) {
+        throw MovieError("cannot write the movie to '" + path + "'");
+    }
+}
@@ -0,0 +1,293 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#include <nchip8/netplay.hpp>
+
+// Unix domain sockets
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+using namespace nchip8;
+
+namespace {
+    constexpr std::uint32_t PACKET_MAGIC = 0x4e384843; // "CH8N" in little-endian
+
+    sockaddr_un socketAddress(const std::string &path) {
+        sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+            throw NetplayError("invalid socket path '" + path + "'");
+        }
+
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+        return addr;
+    }
+
+    std::string systemError(const std::string &what) {
+        return what + ": " + std::strerror(errno);
+    }
+}
+
+NetplayError::NetplayError(const std::string &err)
+    : VMError { err } {
+
+}
+
+NetplaySession::NetplaySession(VM &vm, const std::string &localPath, const std::string &remotePath)
+    : m_vm { vm },
+      m_localPath { localPath },
+      m_remotePath { remotePath },
+      m_saves(HISTORY_SIZE) {
+    if (vm.mode() == VMMode::EMPTY) {
+        throw NetplayError("no ROM is loaded");
+    }
+
+    // The number of instructions per frame would depend on the wall time of each side
+    if (vm.cfg.uncapCyclesPerSec) {
+        throw NetplayError("netplay doesn't work with uncapped cycles/sec");
+    }
+
+    // FNV-1a of everything that must be the same on both sides
+    m_sessionHash = 0xcbf29ce484222325;
+
+    auto mix = [this](std::uint64_t value) {
+        m_sessionHash = (m_sessionHash ^ value) * 0x100000001b3;
+    };
+
+    const Quirks &quirks = vm.quirks();
+
+    mix(vm.romHash());
+    mix((std::uint64_t) vm.ext());
+    mix(quirks.jumpOffsetUseV0);
+    mix(quirks.wrapPixelsX);
+    mix(quirks.wrapPixelsY);
+    mix(quirks.bitwiseResetVF);
+    mix(quirks.shiftSetVxToVy);
+    mix(quirks.loadSaveIncrementI);
+    mix(quirks.draw8x16SpriteInLores);
+    mix(quirks.collisionCountRows);
+    mix(vm.cfg.cyclesPerSec);
+    mix(vm.state.rplFlags);
+
+    sockaddr_un addr = socketAddress(localPath);
+    socketAddress(remotePath);
+
+    m_socket = socket(AF_UNIX, SOCK_DGRAM, 0);
+
+    if (m_socket < 0) {
+        throw NetplayError(systemError("cannot create a socket"));
+    }
+
+    // A socket file left by a previous session would make bind() fail
+    unlink(localPath.c_str());
+
+    if (bind(m_socket, (const sockaddr *) &addr, sizeof(addr)) < 0 ||
+        fcntl(m_socket, F_SETFL, fcntl(m_socket, F_GETFL) | O_NONBLOCK) < 0) {
+        std::string err = systemError("cannot bind the socket to '" + localPath + "'");
+        close(m_socket);
+
+        throw NetplayError(err);
+    }
+
+    vm.overrideRngSeed((unsigned) vm.romHash());
+    vm.restart();
+}
+
+NetplaySession::~NetplaySession() {
+    m_vm.overrideRngSeed(std::nullopt);
+    close(m_socket);
+    unlink(m_localPath.c_str());
+}
+
+void NetplaySession::update() {
+    constexpr std::int64_t MAX_PENDING_FRAMES = 4;
+    constexpr std::int64_t FRAME_LENGTH = 1'000'000'000;
+
+    Clock::time_point currentTime = Clock::now();
+    auto deltaTime = std::chrono::duration_cast<std::chrono::nanoseconds>(currentTime - m_lastUpdate);
+    m_lastUpdate = currentTime;
+
+    if (m_vm.mode() != VMMode::RUN) {
+        return;
+    }
+
+    m_pendingTime = std::min(m_pendingTime + deltaTime.count() * TIMER_FREQ, MAX_PENDING_FRAMES * FRAME_LENGTH);
+
+    // While waiting for the other side, the time keeps pending (up to the limit), so the frames are caught up later
+    while (m_pendingTime >= FRAME_LENGTH && runFrame()) {
+        m_pendingTime -= FRAME_LENGTH;
+    }
+}
+
+bool NetplaySession::runFrame() {
+    std::uint64_t mispredicted = receive();
+
+    if (mispredicted < m_frame) {
+        rollback(mispredicted);
+    }
+
+    if (m_frame >= m_remoteConfirmed + MAX_ROLLBACK_FRAMES || m_frame >= m_localAcked + HISTORY_SIZE) {
+        send();
+
+        return false;
+    }
+
+    m_localInputs[m_frame % HISTORY_SIZE] = m_localKeys;
+    simulate(m_frame);
+    ++m_frame;
+
+    send();
+
+    if (m_vm.audioSink) {
+        m_vm.audioSink->frame(m_vm.toneOn());
+    }
+
+    m_vm.present();
+
+    return true;
+}
+
+void NetplaySession::setKey(std::size_t key, bool pressed) {
+    if (key >= KEY_COUNT) {
+        return;
+    }
+
+    m_localKeys = (std::uint16_t) (pressed ? m_localKeys | 1u << key : m_localKeys & ~(1u << key));
+}
+
+std::uint64_t NetplaySession::frame() const {
+    return m_frame;
+}
+
+std::uint64_t NetplaySession::confirmedFrame() const {
+    return m_remoteConfirmed;
+}
+
+std::uint64_t NetplaySession::rollbackCount() const {
+    return m_rollbackCount;
+}
+
+std::uint64_t NetplaySession::resimulatedFrames() const {
+    return m_resimulatedFrames;
+}
+
+std::uint64_t NetplaySession::receive() {
+    std::uint64_t mispredicted = m_frame;
+    Packet packet;
+
+    while (true) {
+        ssize_t size = recv(m_socket, &packet, sizeof(packet), 0);
+
+        if (size < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
+            throw NetplayError(systemError("cannot receive from the other side"));
+        }
+
+        if ((std::size_t) size != sizeof(packet) || packet.magic != PACKET_MAGIC || packet.keyCount > HISTORY_SIZE) {
+            continue;
+        }
+
+        if (packet.sessionHash != m_sessionHash) {
+            throw NetplayError("the other side runs a different ROM or with different settings");
+        }
+
+        m_localAcked = std::max(m_localAcked, std::min(packet.ack, m_frame));
+
+        for (std::uint32_t i = 0; i < packet.keyCount; ++i) {
+            std::uint64_t frame = packet.firstFrame + i;
+
+            // Already known, or there is a gap before it
+            if (frame != m_remoteConfirmed) {
+                continue;
+            }
+
+            std::uint16_t keys = packet.keys[i];
+            m_remoteInputs[frame % HISTORY_SIZE] = keys;
+
+            if (frame < m_frame && keys != m_usedRemoteInputs[frame % HISTORY_SIZE]) {
+                mispredicted = std::min(mispredicted, frame);
+            }
+
+            ++m_remoteConfirmed;
+        }
+    }
+
+    return mispredicted;
+}
+
+void NetplaySession::send() {
+    Packet packet;
+    std::memset(&packet, 0, sizeof(packet));
+
+    packet.magic       = PACKET_MAGIC;
+    packet.sessionHash = m_sessionHash;
+    packet.ack         = m_remoteConfirmed;
+    packet.firstFrame  = m_localAcked;
+    packet.keyCount    = (std::uint32_t) (m_frame - m_localAcked);
+
+    for (std::uint32_t i = 0; i < packet.keyCount; ++i) {
+        packet.keys[i] = m_localInputs[(m_localAcked + i) % HISTORY_SIZE];
+    }
+
+    sockaddr_un addr = socketAddress(m_remotePath);
+
+    // The other side may not be running yet, or may not keep up; the keys are sent again with the next packet
+    sendto(m_socket, &packet, sizeof(packet), 0, (const sockaddr *) &addr, sizeof(addr));
+}
+
+void NetplaySession::rollback(std::uint64_t from) {
+    // Only the last frame is presented
+    DisplaySink *displaySink = m_vm.displaySink;
+    m_vm.displaySink = nullptr;
+
+    try {
+        m_vm.rollBackTo(m_saves[from % HISTORY_SIZE]);
+
+        for (std::uint64_t frame = from; frame < m_frame; ++frame) {
+            simulate(frame);
+        }
+    } catch (const VMError &) {
+        m_vm.displaySink = displaySink;
+
+        throw;
+    }
+
+    m_vm.displaySink = displaySink;
+
+    ++m_rollbackCount;
+    m_resimulatedFrames += m_frame - from;
+}
+
+void NetplaySession::simulate(std::uint64_t frame) {
+    std::uint16_t remote = remoteKeys(frame);
+
+    m_vm.saveState(m_saves[frame % HISTORY_SIZE]);
+    m_usedRemoteInputs[frame % HISTORY_SIZE] = remote;
+
+    m_vm.state.keys = m_localInputs[frame % HISTORY_SIZE] | remote;
+    m_vm.simulateFrame();
+}
+
+std::uint16_t NetplaySession::remoteKeys(std::uint64_t frame) const {
+    if (frame < m_remoteConfirmed) {
+        return m_remoteInputs[frame % HISTORY_SIZE];
+    }
+
+    // The keys are usually held for many frames, so the last known ones are the best guess
+    return m_remoteConfirmed > 0 ? m_remoteInputs[(m_remoteConfirmed - 1) % HISTORY_SIZE] : 0;
+}
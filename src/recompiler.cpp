@@ -0,0 +1,338 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#include <nchip8/recompiler.hpp>
+
+#include <cstring>
+
+#if NCHIP8_RECOMPILER_SUPPORTED
+# include <sys/mman.h>
+#endif
+
+using namespace nchip8;
+
+namespace {
+    // Values of the ModRM reg field
+    constexpr std::uint8_t REG_AL = 0;
+
+    // The longest instruction sequence emitted for one CHIP-8 instruction (a call to a handler) is 25 bytes
+    constexpr std::size_t MAX_INSTR_CODE_SIZE = 32;
+}
+
+Recompiler::Recompiler(VM &vm)
+    : m_vm { vm } {
+    auto disp = [&vm](const void *field) -> std::int32_t {
+        return (std::int32_t) ((const std::uint8_t *) field - (const std::uint8_t *) &vm);
+    };
+
+    m_regsDisp = disp(&vm.state.regs[0]);
+    m_iDisp    = disp(&vm.state.i);
+    m_dtDisp   = disp(&vm.state.dt);
+    m_stDisp   = disp(&vm.state.st);
+
+#if NCHIP8_RECOMPILER_SUPPORTED
+    // The buffer is writable only while a block is being copied into it, otherwise it's only executable
+    void *code = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (code != MAP_FAILED) {
+        m_code = (std::uint8_t *) code;
+    }
+#endif
+}
+
+Recompiler::~Recompiler() {
+#if NCHIP8_RECOMPILER_SUPPORTED
+    if (m_code) {
+        munmap(m_code, CODE_BUFFER_SIZE);
+    }
+#endif
+}
+
+bool Recompiler::supported() {
+    return NCHIP8_RECOMPILER_SUPPORTED;
+}
+
+std::size_t Recompiler::run(std::uint16_t addr, std::size_t maxCycles) {
+    if (!m_code || addr >= MEM_SIZE) {
+        return 0;
+    }
+
+    Block &block = m_blocks[addr];
+
+    if (!block.code) {
+        if (block.uncompilable || ++block.hits < HOT_THRESHOLD) {
+            return 0;
+        }
+
+        if (!compile(addr, block)) {
+            block.uncompilable = true;
+
+            return 0;
+        }
+    }
+
+    if (block.length > maxCycles) {
+        return 0;
+    }
+
+    block.code(&m_vm);
+    m_vm.state.pc = (std::uint16_t) (addr + 2 * block.length);
+
+    return block.length;
+}
+
+void Recompiler::invalidate(std::uint16_t addr, std::size_t size) {
+    if (addr >= MEM_SIZE) {
+        return;
+    }
+
+    // A block that was too short may become longer after the instructions have been changed
+    std::size_t begin = addr > 0 ? addr - 1u : 0u;
+    std::size_t end   = std::min((std::size_t) addr + size, MEM_SIZE);
+    bool overlaps = false;
+
+    for (std::size_t i = begin; i < end; ++i) {
+        m_blocks[i].uncompilable = false;
+        m_blocks[i].hits = 0;
+
+        overlaps = overlaps || m_covered[i];
+    }
+
+    // Self-modifying code is rare, so it isn't worth tracking which blocks exactly are affected
+    if (overlaps) {
+        flush();
+    }
+}
+
+void Recompiler::flush() {
+    m_blocks.fill({ });
+    m_covered.reset();
+    m_calloutOps.clear();
+    m_codeSize = 0;
+}
+
+bool Recompiler::compile(std::uint16_t addr, Block &block) {
+    if (m_codeSize + MAX_BLOCK_LENGTH * MAX_INSTR_CODE_SIZE + 16 > CODE_BUFFER_SIZE) {
+        flush();
+    }
+
+    m_buf.clear();
+
+    emit({ 0x53 });             // push rbx
+    emit({ 0x48, 0x89, 0xfb }); // mov rbx, rdi (rbx holds the VM pointer from now on)
+
+    const auto &memory = m_vm.state.memory;
+    std::size_t length = 0;
+
+    for (std::size_t pc = addr; length < MAX_BLOCK_LENGTH && pc + 1 < MEM_SIZE; pc += 2) {
+        auto opcode = (std::uint16_t) ((memory[pc] << 8) | memory[pc + 1]);
+
+        if (!emitInstr(opcode)) {
+            break;
+        }
+
+        ++length;
+    }
+
+    if (length < MIN_BLOCK_LENGTH) {
+        return false;
+    }
+
+    emit({ 0x5b }); // pop rbx
+    emit({ 0xc3 }); // ret
+
+#if NCHIP8_RECOMPILER_SUPPORTED
+    std::uint8_t *dest = m_code + m_codeSize;
+
+    if (mprotect(m_code, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+
+    std::memcpy(dest, m_buf.data(), m_buf.size());
+
+    if (mprotect(m_code, CODE_BUFFER_SIZE, PROT_READ | PROT_EXEC) != 0) {
+        return false;
+    }
+
+    m_codeSize += m_buf.size();
+
+    block.code   = (Code) (void *) dest;
+    block.length = (std::uint16_t) length;
+
+    for (std::size_t i = addr; i < addr + 2 * length; ++i) {
+        m_covered[i] = true;
+    }
+
+    return true;
+#else
+    (void) block;
+
+    return false;
+#endif
+}
+
+bool Recompiler::emitInstr(std::uint16_t opcode) {
+    auto kind = m_vm.tryDecodeOpcode(opcode);
+
+    if (!kind) {
+        return false;
+    }
+
+    OperandMap ops(opcode);
+    const Quirks &quirks = m_vm.quirks();
+
+    std::int32_t vx = regDisp(ops.x);
+    std::int32_t vy = regDisp(ops.y);
+    std::int32_t vf = regDisp(0xf);
+
+    // Stores the carry flag (or its inverse) to VF
+    auto emitSetVF = [&](bool carry) {
+        emit({ 0x0f, (std::uint8_t) (carry ? 0x92 : 0x93), 0xc0 }); // setc/setnc al
+        emit({ 0x88 }); emitMem(REG_AL, vf);                       // mov [vf], al
+    };
+
+    auto emitBitwise = [&](std::uint8_t op) {
+        if (quirks.bitwiseResetVF) {
+            emit({ 0xc6 }); emitMem(0, vf); emit({ 0x00 }); // mov byte [vf], 0
+        }
+
+        emit({ 0x8a }); emitMem(REG_AL, vy); // mov al, [vy]
+        emit({ op });   emitMem(REG_AL, vx); // or/and/xor [vx], al
+    };
+
+    switch (kind.value()) {
+    case InstrKind::LOAD_BYTE:
+        emit({ 0xc6 }); emitMem(0, vx); emit({ ops.imm2 }); // mov byte [vx], imm8
+
+        break;
+    case InstrKind::ADD:
+        emit({ 0x80 }); emitMem(0, vx); emit({ ops.imm2 }); // add byte [vx], imm8
+
+        break;
+    case InstrKind::LOAD_REG:
+        emit({ 0x8a }); emitMem(REG_AL, vy); // mov al, [vy]
+        emit({ 0x88 }); emitMem(REG_AL, vx); // mov [vx], al
+
+        break;
+    case InstrKind::OR:  emitBitwise(0x08); break;
+    case InstrKind::AND: emitBitwise(0x20); break;
+    case InstrKind::XOR: emitBitwise(0x30); break;
+    case InstrKind::ADD_REG:
+        emit({ 0x8a }); emitMem(REG_AL, vx); // mov al, [vx]
+        emit({ 0x02 }); emitMem(REG_AL, vy); // add al, [vy]
+        emit({ 0x88 }); emitMem(REG_AL, vx); // mov [vx], al
+        emitSetVF(true);
+
+        break;
+    case InstrKind::SUB_REG:
+        emit({ 0x8a }); emitMem(REG_AL, vx); // mov al, [vx]
+        emit({ 0x2a }); emitMem(REG_AL, vy); // sub al, [vy]
+        emit({ 0x88 }); emitMem(REG_AL, vx); // mov [vx], al
+        emitSetVF(false);
+
+        break;
+    case InstrKind::LOAD_AND_SUB_REG:
+        emit({ 0x8a }); emitMem(REG_AL, vy); // mov al, [vy]
+        emit({ 0x2a }); emitMem(REG_AL, vx); // sub al, [vx]
+        emit({ 0x88 }); emitMem(REG_AL, vx); // mov [vx], al
+        emitSetVF(false);
+
+        break;
+    case InstrKind::RSHIFT:
+    case InstrKind::LSHIFT:
+        emit({ 0x8a }); emitMem(REG_AL, quirks.shiftSetVxToVy ? vy : vx); // mov al, [vy or vx]
+
+        if (kind.value() == InstrKind::RSHIFT) {
+            emit({ 0xd0, 0xe8 }); // shr al, 1 (CF = the shifted out bit)
+        } else {
+            emit({ 0xd0, 0xe0 }); // shl al, 1
+        }
+
+        emit({ 0x88 }); emitMem(REG_AL, vx); // mov [vx], al
+        emitSetVF(true);
+
+        break;
+    case InstrKind::LOAD_I:
+        emit({ 0x66, 0xc7 }); emitMem(0, m_iDisp); emitU16(ops.imm3); // mov word [i], imm16
+
+        break;
+    case InstrKind::ADD_I:
+        emit({ 0x0f, 0xb6 }); emitMem(REG_AL, vx);     // movzx eax, byte [vx]
+        emit({ 0x66, 0x01 }); emitMem(REG_AL, m_iDisp); // add word [i], ax
+
+        break;
+    case InstrKind::FONT_CHAR:
+        static_assert(FONT_CHAR_SIZE.y == 5, "the font char address is computed as VX * 5");
+
+        emit({ 0x0f, 0xb6 }); emitMem(REG_AL, vx); // movzx eax, byte [vx]
+        emit({ 0x8d, 0x04, 0x80 });                // lea eax, [rax + rax * 4]
+
+        if (FONT_OFFSET != 0) {
+            emit({ 0x05 }); emitI32(FONT_OFFSET); // add eax, imm32
+        }
+
+        emit({ 0x66, 0x89 }); emitMem(REG_AL, m_iDisp); // mov [i], ax
+
+        break;
+    case InstrKind::LOAD_DT:
+        emit({ 0x8a }); emitMem(REG_AL, m_dtDisp); // mov al, [dt]
+        emit({ 0x88 }); emitMem(REG_AL, vx);       // mov [vx], al
+
+        break;
+    case InstrKind::SET_DT:
+    case InstrKind::SET_ST:
+        emit({ 0x8a }); emitMem(REG_AL, vx); // mov al, [vx]
+        emit({ 0x88 }); emitMem(REG_AL, kind.value() == InstrKind::SET_DT ? m_dtDisp : m_stDisp); // mov [dt/st], al
+
+        break;
+    case InstrKind::RANDOM:
+    case InstrKind::BIG_FONT_CHAR:
+    case InstrKind::REG_LOAD:
+        // These don't throw and don't write to the memory, so it's safe to call the handlers from the native code
+        emitCall(m_vm.handler(opcode), ops);
+
+        break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+void Recompiler::emit(std::initializer_list<std::uint8_t> bytes) {
+    m_buf.insert(m_buf.end(), bytes);
+}
+
+void Recompiler::emitU16(std::uint16_t value) {
+    emit({ (std::uint8_t) value, (std::uint8_t) (value >> 8) });
+}
+
+void Recompiler::emitI32(std::int32_t value) {
+    auto u = (std::uint32_t) value;
+
+    emit({ (std::uint8_t) u, (std::uint8_t) (u >> 8), (std::uint8_t) (u >> 16), (std::uint8_t) (u >> 24) });
+}
+
+void Recompiler::emitU64(std::uint64_t value) {
+    emitI32((std::int32_t) (std::uint32_t) value);
+    emitI32((std::int32_t) (std::uint32_t) (value >> 32));
+}
+
+void Recompiler::emitMem(std::uint8_t reg, std::int32_t disp) {
+    // mod = 10 (disp32), rm = 011 (rbx)
+    emit({ (std::uint8_t) (0x80 | (reg << 3) | 0x03) });
+    emitI32(disp);
+}
+
+void Recompiler::emitCall(Instruction::Impl impl, const OperandMap &ops) {
+    const OperandMap &stored = m_calloutOps.emplace_back(ops);
+
+    emit({ 0x48, 0x89, 0xdf });                                   // mov rdi, rbx
+    emit({ 0x48, 0xbe }); emitU64((std::uint64_t) &stored);      // mov rsi, imm64
+    emit({ 0x48, 0xb8 }); emitU64((std::uint64_t) (void *) impl); // mov rax, imm64
+    emit({ 0xff, 0xd0 });                                         // call rax
+}
+
+std::int32_t Recompiler::regDisp(std::size_t reg) const {
+    return m_regsDisp + (std::int32_t) reg;
+}
@@ -0,0 +1,220 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#include <nchip8/rewinder.hpp>
+
+#include <cstring>
+#include <utility>
+
+using namespace nchip8;
+
+namespace {
+    // The save states are compared and XORed in 64-bit words
+    using Word = std::uint64_t;
+
+    constexpr std::size_t WORD_COUNT = sizeof(SaveState) / sizeof(Word);
+
+    static_assert(sizeof(SaveState) % sizeof(Word) == 0);
+    static_assert(WORD_COUNT <= UINT16_MAX, "run lengths are stored in 16 bits");
+
+    Word loadWord(const void *data, std::size_t idx) {
+        Word word;
+        std::memcpy(&word, (const std::uint8_t *) data + idx * sizeof(Word), sizeof(Word));
+
+        return word;
+    }
+
+    void storeWord(void *data, std::size_t idx, Word word) {
+        std::memcpy((std::uint8_t *) data + idx * sizeof(Word), &word, sizeof(Word));
+    }
+
+    void appendU16(std::vector<std::uint8_t> &out, std::size_t value) {
+        out.push_back((std::uint8_t) (value & 0xff));
+        out.push_back((std::uint8_t) (value >> 8));
+    }
+
+    std::size_t readU16(const std::uint8_t *in) {
+        return (std::size_t) in[0] | (std::size_t) in[1] << 8;
+    }
+}
+
+Rewinder::Rewinder(const CPUConfig &cfg)
+    : m_cfg { cfg } {
+}
+
+void Rewinder::capture(const VM &vm) {
+    if (m_groups.empty() || m_groups.back().deltas.size() + 1 >= KEYFRAME_INTERVAL) {
+        Group &group = m_groups.emplace_back();
+        vm.saveState(group.keyframe);
+
+        m_memoryUsage += sizeof(SaveState);
+    } else {
+        Group &group = m_groups.back();
+        Delta delta;
+
+        if (!m_freeDeltas.empty()) {
+            delta = std::move(m_freeDeltas.back());
+            m_freeDeltas.pop_back();
+        }
+
+        vm.saveState(m_scratch);
+        encode(m_scratch, group.keyframe, delta);
+
+        m_memoryUsage += delta.capacity();
+        group.deltas.push_back(std::move(delta));
+    }
+
+    ++m_frameCount;
+    m_newestCycle = vm.cycleCount();
+
+    trim();
+}
+
+bool Rewinder::rewind(VM &vm) {
+    if (m_newestCycle == vm.cycleCount()) {
+        dropNewest();
+    }
+
+    m_newestCycle.reset();
+
+    if (m_groups.empty()) {
+        return false;
+    }
+
+    Group &group = m_groups.back();
+
+    if (group.deltas.empty()) {
+        vm.rollBackTo(group.keyframe);
+    } else {
+        decode(group.deltas.back(), group.keyframe, m_scratch);
+        vm.rollBackTo(m_scratch);
+    }
+
+    dropNewest();
+
+    return true;
+}
+
+void Rewinder::clear() {
+    for (auto &group : m_groups) {
+        for (auto &delta : group.deltas) {
+            recycle(std::move(delta));
+        }
+    }
+
+    m_groups.clear();
+    m_frameCount = 0;
+    m_memoryUsage = 0;
+    m_newestCycle.reset();
+}
+
+std::size_t Rewinder::frameCount() const {
+    return m_frameCount;
+}
+
+std::size_t Rewinder::memoryUsage() const {
+    return m_memoryUsage;
+}
+
+// The delta is a sequence of records: the number of equal words to skip, the number of differing words, and these
+// words XORed with the keyframe (all counts are 16-bit little-endian)
+void Rewinder::encode(const SaveState &save, const SaveState &keyframe, Delta &delta) const {
+    delta.clear();
+
+    std::size_t i = 0;
+
+    while (i < WORD_COUNT) {
+        std::size_t skipBegin = i;
+
+        while (i < WORD_COUNT && loadWord(&save, i) == loadWord(&keyframe, i)) {
+            ++i;
+        }
+
+        std::size_t diffBegin = i;
+
+        while (i < WORD_COUNT && loadWord(&save, i) != loadWord(&keyframe, i)) {
+            ++i;
+        }
+
+        // The trailing equal words don't need a record
+        if (diffBegin == i) {
+            break;
+        }
+
+        appendU16(delta, diffBegin - skipBegin);
+        appendU16(delta, i - diffBegin);
+
+        std::size_t offset = delta.size();
+        delta.resize(offset + (i - diffBegin) * sizeof(Word));
+
+        for (std::size_t j = diffBegin; j < i; ++j) {
+            storeWord(&delta[offset], j - diffBegin, loadWord(&save, j) ^ loadWord(&keyframe, j));
+        }
+    }
+}
+
+void Rewinder::decode(const Delta &delta, const SaveState &keyframe, SaveState &save) const {
+    save = keyframe;
+
+    const std::uint8_t *in = delta.data();
+    const std::uint8_t *end = in + delta.size();
+    std::size_t i = 0;
+
+    while (in < end) {
+        i += readU16(in);
+        std::size_t diffCount = readU16(in + 2);
+        in += 4;
+
+        for (std::size_t j = 0; j < diffCount; ++j, ++i) {
+            storeWord(&save, i, loadWord(&save, i) ^ loadWord(in, j));
+        }
+
+        in += diffCount * sizeof(Word);
+    }
+}
+
+void Rewinder::trim() {
+    std::size_t maxFrames = (std::size_t) m_cfg.rewindSeconds * TIMER_FREQ;
+    std::size_t maxMemory = (std::size_t) m_cfg.rewindMemoryMB * 1024 * 1024;
+
+    // The newest group is never dropped, so the last frames can always be rewound
+    while (m_groups.size() > 1 && (m_frameCount > maxFrames || m_memoryUsage > maxMemory)) {
+        Group &group = m_groups.front();
+
+        m_frameCount -= 1 + group.deltas.size();
+        m_memoryUsage -= sizeof(SaveState);
+
+        for (auto &delta : group.deltas) {
+            recycle(std::move(delta));
+        }
+
+        m_groups.pop_front();
+    }
+}
+
+void Rewinder::dropNewest() {
+    if (m_groups.empty()) {
+        return;
+    }
+
+    Group &group = m_groups.back();
+
+    if (group.deltas.empty()) {
+        m_memoryUsage -= sizeof(SaveState);
+        m_groups.pop_back();
+    } else {
+        recycle(std::move(group.deltas.back()));
+        group.deltas.pop_back();
+    }
+
+    --m_frameCount;
+}
+
+void Rewinder::recycle(Delta &&delta) {
+    m_memoryUsage -= delta.capacity();
+
+    // Buffers for one keyframe interval are enough, the rest are freed, so the memory limit holds
+    if (m_freeDeltas.size() < KEYFRAME_INTERVAL) {
+        m_freeDeltas.push_back(std::move(delta));
+    }
+}
@@ -0,0 +1,57 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#include <nchip8/rng.hpp>
+
+using namespace nchip8;
+
+void Rng::seed(std::uint64_t seed, std::uint64_t stream) {
+    m_state = 0;
+    m_increment = (stream << 1u) | 1u;
+    next();
+    m_state += seed;
+    next();
+}
+
+void Rng::advance(std::uint64_t n) {
+    // The generator is an LCG, so n steps of it are an LCG too, with the multiplier and the increment composed by
+    // squaring (Brown, "Random Number Generation with Arbitrary Stride")
+    std::uint64_t curMult = MULTIPLIER;
+    std::uint64_t curPlus = m_increment;
+    std::uint64_t accMult = 1;
+    std::uint64_t accPlus = 0;
+
+    while (n > 0) {
+        if (n & 1) {
+            accMult *= curMult;
+            accPlus = accPlus * curMult + curPlus;
+        }
+
+        curPlus = (curMult + 1) * curPlus;
+        curMult *= curMult;
+        n >>= 1;
+    }
+
+    m_state = accMult * m_state + accPlus;
+}
+
+std::uint64_t Rng::state() const {
+    return m_state;
+}
+
+std::uint64_t Rng::increment() const {
+    return m_increment;
+}
+
+void Rng::restore(std::uint64_t state, std::uint64_t increment) {
+    m_state = state;
+    m_increment = increment | 1u;
+}
+
+bool Rng::operator==(const Rng &other) const {
+    return m_state == other.m_state && m_increment == other.m_increment;
+}
+
+bool Rng::operator!=(const Rng &other) const {
+    return !(*this == other);
+}
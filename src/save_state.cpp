@@ -0,0 +1,177 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#include <nchip8/vm.hpp>
+#include <nchip8/binary_io.hpp>
+
+#include <fstream>
+#include <iterator>
+
+using namespace nchip8;
+
+// The file format (all integers are little-endian):
+//
+//   u32 magic, u32 version, u64 ROM hash, u8 extension, u8 quirk bits,
+//   16 x u8 V registers, u16 PC, u16 I, u8 delay timer, u8 sound timer, u8 stack size, u16 keys, 16 x u16 stack,
+//   u64 PRNG state, u64 PRNG increment, u64 RPL flags, u16 ROM size,
+//   u16 memory length, the memory up to that length (the zeros at the end are left out),
+//   u8 resolution, the lines of the framebuffer in that resolution (32 or 64), each as 2 x u64,
+//   u64 pending time, u32 cycle remainder, u64 cycle count, u64 frame count,
+//   u8 waiting for a key release (FX0A), u8 key to release
+//
+// So a save state takes about 1-5 KiB, depending on the ROM and the resolution.
+namespace {
+    std::size_t lineCount(Resolution res) {
+        return (std::size_t) (res == Resolution::HIGH ? HIRES_DISPLAY_SIZE.y : LORES_DISPLAY_SIZE.y);
+    }
+}
+
+SaveState::SaveState(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file) {
+        throw InvalidSaveState("file '" + path + "' cannot be opened. May not exist or may not have read permission");
+    }
+
+    std::vector<std::uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    ByteReader<InvalidSaveState> in(bytes, "the save state file");
+
+    if (in.u32() != MAGIC) {
+        throw InvalidSaveState("file '" + path + "' isn't an nCHIP-8 save state");
+    }
+
+    if (in.u32() != VERSION) {
+        throw InvalidSaveState("save state '" + path + "' was made by an incompatible version of nCHIP-8");
+    }
+
+    romHash = in.u64();
+
+    std::uint8_t extByte = in.u8();
+    quirks = unpackQuirks(in.u8());
+
+    for (auto &reg : state.regs) {
+        reg = in.u8();
+    }
+
+    state.pc   = in.u16();
+    state.i    = in.u16();
+    state.dt   = in.u8();
+    state.st   = in.u8();
+    state.sp   = in.u8();
+    state.keys = in.u16();
+
+    for (auto &addr : state.stack) {
+        addr = in.u16();
+    }
+
+    std::uint64_t rngState = in.u64();
+    state.rng.restore(rngState, in.u64());
+    state.rplFlags = in.u64();
+    state.romSize  = in.u16();
+
+    std::uint16_t memoryLength = in.u16();
+
+    if (extByte > (std::uint8_t) Extension::SCHIP || state.sp > STACK_MAX_SIZE || state.romSize > PROG_MAX_SIZE ||
+        memoryLength > MEM_SIZE) {
+        throw InvalidSaveState();
+    }
+
+    ext = (Extension) extByte;
+
+    state.memory.fill(0);
+
+    for (std::size_t addr = 0; addr < memoryLength; ++addr) {
+        state.memory[addr] = in.u8();
+    }
+
+    std::uint8_t resByte = in.u8();
+
+    if (resByte > (std::uint8_t) Resolution::HIGH) {
+        throw InvalidSaveState();
+    }
+
+    res = (Resolution) resByte;
+    frame = {};
+
+    for (std::size_t y = 0; y < lineCount(res); ++y) {
+        for (auto &word : frame[y]) {
+            word = in.u64();
+        }
+    }
+
+    pendingTime    = (std::int64_t) in.u64();
+    cycleRemainder = in.u32();
+    cycleCount     = in.u64();
+    frameCount     = in.u64();
+
+    waitForKeyRelease = in.u8() != 0;
+    keyToRelease      = in.u8();
+
+    if (keyToRelease >= KEY_COUNT || !in.atEnd()) {
+        throw InvalidSaveState();
+    }
+}
+
+void SaveState::writeFile(const std::string &path) const {
+    ByteWriter out;
+
+    out.u32(magic);
+    out.u32(version);
+    out.u64(romHash);
+    out.u8((std::uint8_t) ext);
+    out.u8(packQuirks(quirks));
+
+    for (auto reg : state.regs) {
+        out.u8(reg);
+    }
+
+    out.u16(state.pc);
+    out.u16(state.i);
+    out.u8(state.dt);
+    out.u8(state.st);
+    out.u8(state.sp);
+    out.u16(state.keys);
+
+    for (auto addr : state.stack) {
+        out.u16(addr);
+    }
+
+    out.u64(state.rng.state());
+    out.u64(state.rng.increment());
+    out.u64(state.rplFlags);
+    out.u16(state.romSize);
+
+    std::size_t memoryLength = MEM_SIZE;
+
+    while (memoryLength > 0 && state.memory[memoryLength - 1] == 0) {
+        --memoryLength;
+    }
+
+    out.u16((std::uint16_t) memoryLength);
+
+    for (std::size_t addr = 0; addr < memoryLength; ++addr) {
+        out.u8(state.memory[addr]);
+    }
+
+    out.u8((std::uint8_t) res);
+
+    for (std::size_t y = 0; y < lineCount(res); ++y) {
+        for (auto word : frame[y]) {
+            out.u64(word);
+        }
+    }
+
+    out.u64((std::uint64_t) pendingTime);
+    out.u32(cycleRemainder);
+    out.u64(cycleCount);
+    out.u64(frameCount);
+
+    out.u8(waitForKeyRelease);
+    out.u8(keyToRelease);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+    if (!file.write((const char *) out.bytes.data(), (std::streamsize) out.bytes.size())) {
+        throw InvalidSaveState("cannot write the save state to '" + path + "'");
+    }
+}
@@ -0,0 +1,134 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+#include <nchip8/thread_pool.hpp>
+
+#include <algorithm>
+#include <utility>
+
+using namespace nchip8;
+
+ThreadPool::ThreadPool(std::size_t workerCount) {
+    if (workerCount == 0) {
+        workerCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    for (std::size_t i = 0; i < workerCount; ++i) {
+        m_queues.push_back(std::make_unique<Queue>());
+    }
+
+    for (std::size_t i = 0; i < workerCount; ++i) {
+        m_workers.emplace_back(&ThreadPool::work, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(m_mutex);
+        m_stop = true;
+    }
+
+    m_workAvailable.notify_all();
+
+    for (auto &worker : m_workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(Task task) {
+    std::size_t index;
+
+    // The tasks are spread evenly, the stealing balances them out later
+    {
+        std::lock_guard lock(m_mutex);
+        index = m_nextQueue;
+        m_nextQueue = (m_nextQueue + 1) % m_queues.size();
+    }
+
+    {
+        Queue &queue = *m_queues[index];
+        std::lock_guard lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+
+    {
+        std::lock_guard lock(m_mutex);
+        ++m_queued;
+        ++m_unfinished;
+    }
+
+    m_workAvailable.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock lock(m_mutex);
+    m_allDone.wait(lock, [this] { return m_unfinished == 0; });
+}
+
+std::size_t ThreadPool::workerCount() const {
+    return m_workers.size();
+}
+
+void ThreadPool::work(std::size_t index) {
+    while (true) {
+        {
+            std::unique_lock lock(m_mutex);
+            m_workAvailable.wait(lock, [this] { return m_stop || m_queued > 0; });
+
+            if (m_queued == 0) {
+                return;
+            }
+
+            // Claim a task. It's already in some queue, since submit() pushes it before counting it.
+            --m_queued;
+        }
+
+        Task task;
+
+        while (!tryPop(index, task) && !trySteal(index, task)) {
+            // Another worker has taken the task from our queue, but it has claimed a different one, which we
+            // are going to find in a moment
+            std::this_thread::yield();
+        }
+
+        task();
+
+        std::lock_guard lock(m_mutex);
+
+        if (--m_unfinished == 0) {
+            m_allDone.notify_all();
+        }
+    }
+}
+
+bool ThreadPool::tryPop(std::size_t index, Task &task) {
+    Queue &queue = *m_queues[index];
+    std::lock_guard lock(queue.mutex);
+
+    if (queue.tasks.empty()) {
+        return false;
+    }
+
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+
+    return true;
+}
+
+bool ThreadPool::trySteal(std::size_t thief, Task &task) {
+    for (std::size_t i = 1; i < m_queues.size(); ++i) {
+        Queue &queue = *m_queues[(thief + i) % m_queues.size()];
+        std::lock_guard lock(queue.mutex);
+
+        if (queue.tasks.empty()) {
+            continue;
+        }
+
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+
+        return true;
+    }
+
+    return false;
+}
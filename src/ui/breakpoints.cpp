@@ -10,9 +10,10 @@
 
 using namespace nchip8::ui;
 
-Breakpoints::Breakpoints(BreakpointMap &bps)
+Breakpoints::Breakpoints(BreakpointMap &bps, EmulationThread &emulation)
     : Window { "Breakpoints", ImGuiWindowFlags_AlwaysAutoResize },
-      m_bps  { bps } {
+      m_bps  { bps },
+      m_emulation { emulation } {
 }
 
 void Breakpoints::body() {
@@ -33,6 +34,7 @@ void Breakpoints::body() {
     ImGui::BeginDisabled(m_bps.has(PROG_OFFSET));
 
     if (ImGui::Button(("Break on start (" + utils::toHexPrefixed(PROG_OFFSET) + ")").c_str())) {
+        auto lock = m_emulation.lock();
         m_bps.add({ "start", PROG_OFFSET });
     }
 
@@ -42,6 +44,7 @@ void Breakpoints::body() {
     ImGui::BeginDisabled(m_bps.empty());
 
     if (ImGui::Button("Remove all")) {
+        auto lock = m_emulation.lock();
         m_bps.clear();
     }
 
@@ -106,9 +109,13 @@ void Breakpoints::body() {
         }
     }
 
-    while (!bpsPendingDelete.empty()) {
-        m_bps.remove(bpsPendingDelete.top());
-        bpsPendingDelete.pop();
+    if (!bpsPendingDelete.empty()) {
+        auto lock = m_emulation.lock();
+
+        while (!bpsPendingDelete.empty()) {
+            m_bps.remove(bpsPendingDelete.top());
+            bpsPendingDelete.pop();
+        }
     }
 
     ImGui::EndTable();
@@ -136,7 +143,10 @@ void Breakpoints::popupAddBreakpoint() {
     ImGui::BeginDisabled(containsOnlyWhitespaces(name));
 
     if (ImGui::Button("Add", ImVec2(60, 0)) && !containsOnlyWhitespaces(name)) {
-        m_bps.add({ std::string(name), offset });
+        {
+            auto lock = m_emulation.lock();
+            m_bps.add({ std::string(name), offset });
+        }
 
         name.clear();
         offset = 0;
@@ -187,8 +197,11 @@ void Breakpoints::popupEditBreakpoint() {
     ImGui::BeginDisabled(containsOnlyWhitespaces(name));
 
     if (ImGui::Button("Save", ImVec2(60, 0))) {
-        m_bps.remove(m_editableBp.offset);
-        m_bps.add({ name, offset });
+        {
+            auto lock = m_emulation.lock();
+            m_bps.remove(m_editableBp.offset);
+            m_bps.add({ name, offset });
+        }
 
         name.clear();
         offset = 0;
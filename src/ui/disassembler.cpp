@@ -10,21 +10,22 @@
 
 using namespace nchip8::ui;
 
-Disassembler::Disassembler(VM &vm)
+Disassembler::Disassembler(VM &vm, EmulationThread &emulation)
     : Window { "Disassembler", ImGuiWindowFlags_AlwaysAutoResize },
-      m_vm   { vm } {
+      m_vm   { vm },
+      m_emulation { emulation } {
 }
 
 void Disassembler::body() {
-    VMState &vmState = m_vm.state;
+    const VMState &vmState = m_emulation.snapshot().state;
 
     ImGui::TextUnformatted("* The yellow row means that the PC counter is pointing to the same address.");
     ImGui::Text("PC: 0x%04" PRIx16, vmState.pc);
-    ImGui::Text("ROM size: %zu bytes", m_vm.state.romSize);
+    ImGui::Text("ROM size: %" PRIu16 " bytes", vmState.romSize);
 
-    if (m_vm.state.romSize > 0) {
+    if (vmState.romSize > 0) {
         ImGui::Text("   lowest address: 0x%04" PRIx16, PROG_OFFSET);
-        ImGui::Text("   highest: 0x%04" PRIx16, (std::uint16_t) (PROG_OFFSET + m_vm.state.romSize - 2));
+        ImGui::Text("   highest: 0x%04" PRIx16, (std::uint16_t) (PROG_OFFSET + vmState.romSize - 2));
     }
 
     if (!ImGui::BeginTable("Memory Content", 3, ImGuiTableFlags_BordersOuter)) {
@@ -68,6 +69,9 @@ void Disassembler::body() {
             ImGui::TableSetColumnIndex(2);
 
             try {
+                // The decoding depends on the extension of the VM
+                auto lock = m_emulation.lock();
+
                 ImGui::TextUnformatted(m_vm.disassemble(opcode).c_str());
             } catch (const InvalidOpcode &ex) {
                 ImGui::TextUnformatted("<unknown>");
@@ -7,12 +7,14 @@
 #include <cinttypes>
 #include <cstddef>
 #include <cstdint>
+#include <optional>
 
 using namespace nchip8::ui;
 
-InstrExecutor::InstrExecutor(VM &vm)
+InstrExecutor::InstrExecutor(VM &vm, EmulationThread &emulation)
     : Window { "Instruction Executor", ImGuiWindowFlags_AlwaysAutoResize },
-      m_vm   { vm } {
+      m_vm   { vm },
+      m_emulation { emulation } {
 }
 
 void InstrExecutor::body() {
@@ -20,7 +22,13 @@ void InstrExecutor::body() {
 
     ImGui::InputScalar("Opcode", ImGuiDataType_U16, &opcode, nullptr, nullptr, "%04" PRIx16);
 
-    auto instrKind = m_vm.tryDecodeOpcode(opcode);
+    std::optional<InstrKind> instrKind;
+
+    {
+        // The decoding depends on the extension of the VM
+        auto lock = m_emulation.lock();
+        instrKind = m_vm.tryDecodeOpcode(opcode);
+    }
     ImGui::Text("Instruction: %s", instrKind.has_value() ? instrKindToString(instrKind.value()).c_str() : "UNKNOWN");
 
     OperandMap ops(opcode);
@@ -45,6 +53,7 @@ void InstrExecutor::body() {
     ImGui::BeginDisabled(!instrKind.has_value());
 
     if (ImGui::Button("Execute")) {
+        auto lock = m_emulation.lock();
         m_vm.execInstr(opcode);
     }
 
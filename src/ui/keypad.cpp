@@ -8,14 +8,16 @@
 
 using namespace nchip8::ui;
 
-Keypad::Keypad(VM &vm)
+Keypad::Keypad(const Config &cfg, VM &vm, EmulationThread &emulation)
     : Window { "Keypad", ImGuiWindowFlags_AlwaysAutoResize },
-      m_vm   { vm } {
+      m_cfg  { cfg },
+      m_vm   { vm },
+      m_emulation { emulation } {
 }
 
 void Keypad::body() {
     static std::bitset<KEY_COUNT> states;
-    const auto &layout = m_vm.cfg.input.layout;
+    const auto &layout = m_cfg.input.layout;
 
     for (std::size_t i = 0; i < KEY_COUNT; ++i) {
         const auto &key = layout[i];
@@ -28,7 +30,9 @@ void Keypad::body() {
 
         if (ImGui::Button(SDL_GetScancodeName(key.first))) {
             states.flip(keyIdx);
-            m_vm.state.inputTable[keyIdx] = states[keyIdx];
+
+            auto lock = m_emulation.lock();
+            m_vm.setKey(keyIdx, states[keyIdx]);
         }
 
         if (pressed) {
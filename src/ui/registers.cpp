@@ -9,43 +9,53 @@
 
 using namespace nchip8::ui;
 
-Registers::Registers(VM &vm)
+Registers::Registers(VM &vm, EmulationThread &emulation)
     : Window { "Registers", ImGuiWindowFlags_AlwaysAutoResize },
-      m_vm   { vm } {
+      m_vm   { vm },
+      m_emulation { emulation } {
 }
 
 void Registers::body() {
+    // Shown from the snapshot, only the edits are written to the VM
+    const auto &snapshot = m_emulation.snapshot().state;
+    auto pc   = snapshot.pc;
+    auto regI = snapshot.i;
+    auto dt   = snapshot.dt;
+    auto st   = snapshot.st;
+    auto regs = snapshot.regs;
+
     auto &state = m_vm.state;
-    auto pc   = m_vm.state.pc;
-    auto regI = m_vm.state.i;
-    auto dt   = m_vm.state.dt;
-    auto st   = m_vm.state.st;
-    auto regs = m_vm.state.regs;
+
+    auto write = [this](auto &reg, auto value) {
+        auto lock = m_emulation.lock();
+
+        reg = value;
+    };
 
     ImGui::PushItemWidth(ImGui::GetFontSize() * 5);
 
     auto flags = ImGuiInputTextFlags_EnterReturnsTrue;
 
     if (ImGui::InputScalar("PC", ImGuiDataType_U16, &pc, nullptr, nullptr, "%04" PRIx16, flags)) {
-        state.pc = pc;
+        write(state.pc, pc);
     }
 
     if (ImGui::InputScalar("I",  ImGuiDataType_U16, &regI, nullptr, nullptr, "%04" PRIx16, flags)) {
-        state.i = regI;
+        write(state.i, regI);
     }
 
     if (ImGui::InputScalar("DT", ImGuiDataType_U8, &dt, nullptr, nullptr, "%02" PRIx8, flags)) {
-        state.dt = dt;
+        write(state.dt, dt);
     }
 
     if (ImGui::InputScalar("ST", ImGuiDataType_U8, &st, nullptr, nullptr, "%02" PRIx8, flags)) {
-        state.st = st;
+        write(state.st, st);
     }
 
-    for (std::size_t i = 0; i < state.regs.size(); ++i) {
+    for (std::size_t i = 0; i < regs.size(); ++i) {
         if (ImGui::InputScalar(("V" + utils::toHexUpper<std::size_t, 1>(i)).c_str(), ImGuiDataType_U8, &regs[i],
                 nullptr, nullptr, "%02" PRIx8, flags)) {
-            state.regs[i] = regs[i];
+            write(state.regs[i], regs[i]);
         }
     }
 
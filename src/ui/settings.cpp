@@ -2,34 +2,46 @@
 // This file is distributed under the MIT license (https://opensource.org/license/mit/)
 
 #include <nchip8/ui/settings.hpp>
+#include <nchip8/recompiler.hpp>
 #include <nchip8/ui/ui.hpp>
 
 #include <cinttypes>
 #include <cstddef>
+#include <cstdint>
 
 using namespace nchip8::ui;
 
-Settings::Settings(sdl::Window &window, VM &vm, UI &ui)
+Settings::Settings(sdl::Window &window, Config &cfg, VM &vm, EmulationThread &emulation,
+                   DisplayRenderer &displayRenderer, AudioOutput &audioOutput, UI &ui)
     : Window { "Settings", ImGuiWindowFlags_AlwaysAutoResize },
       m_window { window },
+      m_cfg    { cfg },
       m_vm     { vm },
+      m_emulation { emulation },
+      m_displayRenderer { displayRenderer },
+      m_audioOutput     { audioOutput },
       m_ui     { ui },
-      m_newCfg     { vm.cfg },
-      m_quirks     { vm.quirks },
-      m_offColor   { imgui::rgbaToImVec4(vm.cfg.graphics.offColor) },
-      m_onColor    { imgui::rgbaToImVec4(vm.cfg.graphics.onColor)  },
-      m_enableGrid { vm.display.gridEnabled() } {
+      m_newCfg     { cfg },
+      m_quirks     { vm.quirks() },
+      m_offColor   { imgui::rgbaToImVec4(cfg.graphics.offColor) },
+      m_onColor    { imgui::rgbaToImVec4(cfg.graphics.onColor)  },
+      m_enableGrid { displayRenderer.gridEnabled() } {
 
 }
 
+void Settings::reloadQuirks() {
+    m_quirks = m_vm.quirks();
+}
+
 void Settings::body() {
-    auto &cfg     = m_vm.cfg;
-    auto &display = m_vm.display;
-    auto &beeper  = m_vm.beeper;
+    auto &cfg      = m_cfg;
+    auto &renderer = m_displayRenderer;
 
     // synchronize if flags were changed by executing the FX75 opcode
-    if (m_newCfg.cpu.rplFlags != cfg.cpu.rplFlags) {
-        m_newCfg.cpu.rplFlags  = cfg.cpu.rplFlags;
+    std::uint64_t rplFlags = m_emulation.snapshot().state.rplFlags;
+
+    if (m_newCfg.cpu.rplFlags != rplFlags) {
+        m_newCfg.cpu.rplFlags  = rplFlags;
     }
 
     if (ImGui::BeginTabBar("Settings Tab bar")) {
@@ -48,33 +60,34 @@ void Settings::body() {
         m_newCfg.graphics.onColor = imgui::imVec4ToRGBA(m_onColor);
 
         if (cfg.graphics.windowSize != m_newCfg.graphics.windowSize) {
-            m_window.SetSize(m_newCfg.graphics.windowSize);
-        }
-
-        if (cfg.sound.waveform != m_newCfg.sound.waveform) {
-            beeper.changeWaveform(m_newCfg.sound.waveform);
+            m_window.SetSize(toSDL(m_newCfg.graphics.windowSize));
         }
 
         if (cfg.ui.style != m_newCfg.ui.style) {
             m_ui.setStyle(m_newCfg.ui.style);
         }
 
-        cfg = m_newCfg;
-        cfg.writeFile();
+        {
+            // The emulation thread reads the config too
+            auto lock = m_emulation.lock();
 
-        m_vm.quirks = m_quirks;
+            cfg = m_newCfg;
 
-        display.setOffColor(cfg.graphics.offColor);
-        display.setOnColor(cfg.graphics.onColor);
-        display.enableGrid(m_enableGrid);
-        display.setScaleFactor(cfg.graphics.scaleFactor);
-        display.wrapPixelsX = m_quirks.wrapPixelsX;
-        display.wrapPixelsY = m_quirks.wrapPixelsY;
-        display.enableFade(cfg.graphics.enableFade);
-        display.setFadeSpeed(cfg.cpu.cyclesPerSec);
+            m_vm.setQuirks(m_quirks);
+            m_vm.display.wrapPixelsX = m_quirks.wrapPixelsX;
+            m_vm.display.wrapPixelsY = m_quirks.wrapPixelsY;
+        }
 
-        beeper.frequency = (int) cfg.sound.frequency;
-        beeper.level = cfg.sound.level;
+        cfg.writeFile();
+
+        renderer.setOffColor(cfg.graphics.offColor);
+        renderer.setOnColor(cfg.graphics.onColor);
+        renderer.enableGrid(m_enableGrid);
+        renderer.setScaleFactor(cfg.graphics.scaleFactor);
+        renderer.enableFade(cfg.graphics.enableFade);
+        renderer.setFadeSpeed(cfg.cpu.cyclesPerSec);
+
+        m_audioOutput.applyConfig();
     };
 
     ImGui::Dummy({ 0, 5 });
@@ -99,12 +112,47 @@ void Settings::body() {
 }
 
 void Settings::sectionCPU() {
+    const auto &snapshot = m_emulation.snapshot();
+    bool moviePlaying = snapshot.recording || snapshot.playingBack;
+    auto runAheadTime = snapshot.runAheadTime;
+
     ImGui::PushItemWidth(ImGui::GetFontSize() * 7);
+
+    // The VM uses the speed of the movie anyway
+    ImGui::BeginDisabled(moviePlaying);
     ImGui::InputScalar("Cycles/sec", ImGuiDataType_U32, &m_newCfg.cpu.cyclesPerSec, nullptr, nullptr, "%" PRId32);
 
-    m_newCfg.cpu.cyclesPerSec = std::clamp(m_newCfg.cpu.cyclesPerSec, 50u, 1000u);
+    m_newCfg.cpu.cyclesPerSec = std::clamp(m_newCfg.cpu.cyclesPerSec, 1u, 10'000'000u);
 
     ImGui::Checkbox("Uncap cycles/sec", &m_newCfg.cpu.uncapCyclesPerSec);
+    ImGui::EndDisabled();
+    marker("Locked while a movie is recorded or played back");
+
+    ImGui::BeginDisabled(!Recompiler::supported());
+    ImGui::Checkbox("Recompile hot code", &m_newCfg.cpu.useRecompiler);
+    ImGui::EndDisabled();
+    marker("Translates hot code into native x86-64 code. Not used while there are breakpoints");
+
+    ImGui::InputScalar("Rewind (sec)", ImGuiDataType_U32, &m_newCfg.cpu.rewindSeconds, nullptr, nullptr, "%" PRId32);
+    marker("Hold Backspace to run the game backwards. 0 disables rewinding");
+    ImGui::InputScalar("Rewind memory (MiB)", ImGuiDataType_U32, &m_newCfg.cpu.rewindMemoryMB, nullptr, nullptr,
+                       "%" PRId32);
+
+    m_newCfg.cpu.rewindSeconds  = std::min(m_newCfg.cpu.rewindSeconds, 3600u);
+    m_newCfg.cpu.rewindMemoryMB = std::clamp(m_newCfg.cpu.rewindMemoryMB, 1u, 4096u);
+
+    ImGui::InputScalar("Run-ahead (frames)", ImGuiDataType_U32, &m_newCfg.cpu.runAheadFrames, nullptr, nullptr,
+                       "%" PRId32);
+    marker("Shows the frames from the future, as if the keys were pressed earlier. Reduces the input lag, but "
+           "games may glitch when running too far ahead");
+
+    m_newCfg.cpu.runAheadFrames = std::min(m_newCfg.cpu.runAheadFrames, 8u);
+
+    if (m_cfg.cpu.runAheadFrames > 0) {
+        ImGui::SameLine();
+        ImGui::TextDisabled("%.1f us/frame", (double) runAheadTime.count() / 1000);
+    }
+
     ImGui::InputScalar("PRNG seed",  ImGuiDataType_U32, &m_newCfg.cpu.rngSeed, nullptr, nullptr, "%" PRId32);
     ImGui::PopItemWidth();
 
@@ -118,7 +166,9 @@ void Settings::sectionCPU() {
 
     if (ImGui::InputScalar("RPL flags", ImGuiDataType_U64, &m_newCfg.cpu.rplFlags, nullptr, nullptr, "%" PRIx64,
                 ImGuiInputTextFlags_EnterReturnsTrue)) {
-        m_vm.cfg.cpu.rplFlags = m_newCfg.cpu.rplFlags;
+        auto lock = m_emulation.lock();
+        m_cfg.cpu.rplFlags = m_newCfg.cpu.rplFlags;
+        m_vm.state.rplFlags = m_newCfg.cpu.rplFlags;
     }
 
     marker("SCHIP/XO-CHIP only");
@@ -144,10 +194,12 @@ void Settings::sectionQuirks() {
     ImGui::SeparatorText("SCHIP");
     ImGui::Checkbox("Dxy0: draw 8x16 sprite in lo-res mode", &m_quirks.draw8x16SpriteInLores);
     markerNotSaved();
+    ImGui::Checkbox("Dxyn: VF counts collided rows in hi-res mode", &m_quirks.collisionCountRows);
+    markerNotSaved();
 }
 
 void Settings::sectionGraphics() {
-    static const sdl::Point windowSizes[] = {
+    static const Point windowSizes[] = {
         { 640,  320 }, { 1280, 640 }, { 1920, 960 }
     };
 
@@ -173,6 +225,18 @@ void Settings::sectionGraphics() {
     markerNotSaved();
 
     ImGui::Checkbox("LCD effect (pixels fade away)", &m_newCfg.graphics.enableFade);
+
+    ImGui::Checkbox("VSync", &m_newCfg.graphics.vsync);
+    marker("Takes effect after a restart");
+
+    ImGui::BeginDisabled(m_newCfg.graphics.vsync);
+    ImGui::PushItemWidth(ImGui::GetFontSize() * 7);
+    ImGui::InputInt("Frame cap (FPS)", &m_newCfg.graphics.frameCap);
+    ImGui::PopItemWidth();
+    ImGui::EndDisabled();
+    marker("Used when vsync is off or not supported. 0 removes the limit");
+
+    m_newCfg.graphics.frameCap = std::clamp(m_newCfg.graphics.frameCap, 0, 1000);
 }
 
 void Settings::sectionInput() {
@@ -214,8 +278,16 @@ void Settings::sectionSound() {
     ImGui::PushItemWidth(ImGui::GetFontSize() * 8);
     ImGui::InputScalar("Sound frequency (Hz)", ImGuiDataType_U32, &m_newCfg.sound.frequency);
     ImGui::InputDouble("Volume (dB)", &m_newCfg.sound.level, 0.5, 1.0, "%.2f");
+    ImGui::InputInt("Latency (ms)", &m_newCfg.sound.latencyMs);
     ImGui::PopItemWidth();
 
+    m_newCfg.sound.latencyMs = std::clamp(m_newCfg.sound.latencyMs, 0, 500);
+
+    ImGui::SameLine();
+    ImGui::TextDisabled("%.1f ms measured", (double) m_audioOutput.latency().count() / 1000);
+    marker("Lower values make the tone start and stop sooner after the game asks for it, but it may crackle if the "
+           "system can't keep up");
+
     static const char *waveformTitles[] = {
         "Sine",
         "Square",
@@ -9,27 +9,27 @@
 
 using namespace nchip8::ui;
 
-Stack::Stack(VM &vm)
+Stack::Stack(EmulationThread &emulation)
     : Window { "Stack", ImGuiWindowFlags_AlwaysAutoResize },
-      m_vm { vm } {
+      m_emulation { emulation } {
 }
 
 void Stack::body() {
-    auto &stack = m_vm.state.stack;
+    const auto &state = m_emulation.snapshot().state;
 
     if (ImGui::BeginTable("Stack", 2, ImGuiTableFlags_Borders)) {
         ImGui::TableSetupColumn("No.");
         ImGui::TableSetupColumn("Data");
         ImGui::TableHeadersRow();
 
-        for (std::size_t i = 0; i < stack.size(); ++i) {
+        for (std::size_t i = 0; i < state.sp; ++i) {
             ImGui::TableNextRow();
 
             ImGui::TableSetColumnIndex(0);
             ImGui::Text("%zu", i + 1);
 
             ImGui::TableSetColumnIndex(1);
-            ImGui::Text("0x%.4" PRIx16, stack.c[i]);
+            ImGui::Text("0x%.4" PRIx16, state.stack[i]);
         }
 
         ImGui::EndTable();
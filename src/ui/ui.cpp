@@ -8,19 +8,23 @@
 
 #include <ImGuiFileDialog.h>
 
+#include <ctime>
 #include <string>
 
 using namespace nchip8::ui;
 
-UI::UI(sdl::Window &window, sdl::Renderer &renderer, VM &vm)
-    : m_vm { vm },
-      m_breakpoints   { vm.breakpoints },
-      m_disassembler  { vm },
-      m_instrExecutor { vm },
-      m_keypad        { vm },
-      m_registers     { vm },
-      m_settings      { window, vm, *this },
-      m_stack         { vm } {
+UI::UI(sdl::Window &window, sdl::Renderer &renderer, Config &cfg, VM &vm, DisplayRenderer &displayRenderer,
+       AudioOutput &audioOutput, EmulationThread &emulation)
+    : m_cfg { cfg },
+      m_vm { vm },
+      m_emulation { emulation },
+      m_breakpoints   { vm.breakpoints, emulation },
+      m_disassembler  { vm, emulation },
+      m_instrExecutor { vm, emulation },
+      m_keypad        { cfg, vm, emulation },
+      m_registers     { vm, emulation },
+      m_settings      { window, cfg, vm, emulation, displayRenderer, audioOutput, *this },
+      m_stack         { emulation } {
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
 
@@ -30,7 +34,7 @@ UI::UI(sdl::Window &window, sdl::Renderer &renderer, VM &vm)
     // Don't save positions and sizes of windows in INI file
     m_io->IniFilename = nullptr;
 
-    setStyle(vm.cfg.ui.style);
+    setStyle(cfg.ui.style);
     ImGuiStyle &style = ImGui::GetStyle();
 
     // Give an old-fashioned feel to the UI
@@ -53,7 +57,20 @@ void UI::update() {
     ImGui_ImplSDL2_NewFrame();
     ImGui::NewFrame();
 
+    // The VM is locked only around the changes made to it (see EmulationThread::lock()), the rest comes from the
+    // snapshot
     input();
+
+    // Whatever stopped the playback (a reset, another ROM, ...), the VM went back to the quirks of the user
+    bool playingBack = m_emulation.snapshot().playingBack;
+
+    if (m_playingBack && !playingBack) {
+        auto lock = m_emulation.lock();
+        m_settings.reloadQuirks();
+    }
+
+    m_playingBack = playingBack;
+
     menu();
     windows();
 
@@ -65,6 +82,8 @@ void UI::update() {
 }
 
 void UI::showError(const std::string &err) {
+    std::lock_guard lock(m_errorMutex);
+
     m_currentError = err;
     m_openErrorPopup = true;
 }
@@ -90,12 +109,17 @@ bool UI::quitRequested() const {
     return m_quitRequested;
 }
 
+bool UI::followsEmulation() const {
+    return m_cfg.cpu.debugMode && m_vm.mode() == VMMode::RUN;
+}
+
 void UI::input() {
     if (ImGui::IsPopupOpen("Error")) {
         return;
     }
 
-    if (m_vm.mode() == VMMode::RUN && m_io->KeyCtrl && ImGui::IsKeyPressed(ImGuiKey_P)) {
+    if (m_emulation.snapshot().mode == VMMode::RUN && m_io->KeyCtrl && ImGui::IsKeyPressed(ImGuiKey_P)) {
+        auto lock = m_emulation.lock();
         m_vm.setMode(VMMode::PAUSED);
 
         m_showPauseScreen = true;
@@ -103,6 +127,7 @@ void UI::input() {
 
     if (!m_showMainMenu) {
         if (m_io->KeyCtrl && ImGui::IsKeyPressed(ImGuiKey_R)) {
+            auto lock = m_emulation.lock();
             m_vm.reset();
         }
 
@@ -111,19 +136,30 @@ void UI::input() {
         }
 
         if (m_io->KeyCtrl && ImGui::IsKeyPressed(ImGuiKey_S)) {
-            try {
-                m_vm.step();
-            } catch (const VMError &err) {
-                showError(err.what());
-            }
+            step();
         }
 
         if (m_io->KeyCtrl && m_io->KeyShift && ImGui::IsKeyPressed(ImGuiKey_C)) {
+            auto lock = m_emulation.lock();
             m_vm.setMode(VMMode::RUN);
         }
+
+        // F1-F4 load the quick slots, Shift-F1-F4 save them
+        for (std::size_t i = 0; i < QUICK_SLOT_COUNT; ++i) {
+            if (!ImGui::IsKeyPressed((ImGuiKey) (ImGuiKey_F1 + (int) i), false)) {
+                continue;
+            }
+
+            if (m_io->KeyShift) {
+                quickSave(i);
+            } else {
+                quickLoad(i);
+            }
+        }
     }
 
     if (m_showPauseScreen && ImGui::IsKeyPressed(ImGuiKey_Escape)) {
+        auto lock = m_emulation.lock();
         m_vm.setMode(m_vm.prevMode());
 
         m_showPauseScreen = false;
@@ -162,20 +198,25 @@ void UI::pauseScreen() {
 }
 
 void UI::popups() {
-    if (m_openErrorPopup) {
-        ImGui::OpenPopup("Error");
+    {
+        std::lock_guard lock(m_errorMutex);
 
-        m_openErrorPopup = false;
+        if (m_openErrorPopup) {
+            ImGui::OpenPopup("Error");
+
+            m_shownError = m_currentError;
+            m_openErrorPopup = false;
+        }
     }
 
     if (!ImGui::BeginPopupModal("Error", nullptr, ImGuiWindowFlags_AlwaysAutoResize)) {
         return;
     }
 
-    ImGui::TextUnformatted(m_currentError.c_str());
+    ImGui::TextUnformatted(m_shownError.c_str());
     ImGui::Dummy({ 0, 10 });
 
-    if (!m_vm.cfg.cpu.debugMode) {
+    if (!m_cfg.cpu.debugMode) {
         if (ImGui::Button("Exit", { 60, 0 })) {
             ImGui::CloseCurrentPopup();
 
@@ -187,11 +228,14 @@ void UI::popups() {
         if (ImGui::Button("Enter debug mode", { 140, 0 })) {
             ImGui::CloseCurrentPopup();
 
+            // The emulation thread reads the config too
+            auto lock = m_emulation.lock();
             m_vm.setMode(VMMode::STEP);
-            m_vm.cfg.cpu.debugMode = true;
+            m_cfg.cpu.debugMode = true;
         }
     } else {
         if (ImGui::Button("Continue", { 70, 0 })) {
+            auto lock = m_emulation.lock();
             m_vm.setMode(VMMode::RUN);
 
             ImGui::CloseCurrentPopup();
@@ -200,6 +244,7 @@ void UI::popups() {
         ImGui::SameLine();
 
         if (ImGui::Button("Break", { 70, 0 })) {
+            auto lock = m_emulation.lock();
             m_vm.setMode(VMMode::STEP);
 
             ImGui::CloseCurrentPopup();
@@ -224,33 +269,119 @@ void UI::menu() {
     // See https://github.com/ocornut/imgui/issues/331
     bool openPauseScreen = false;
 
+    const auto &snapshot = m_emulation.snapshot();
+    VMMode mode      = snapshot.mode;
+    bool recording   = snapshot.recording;
+    bool playingBack = snapshot.playingBack;
+
     menuLabel("CONTROL");
 
-    ImGui::BeginDisabled(m_vm.mode() == VMMode::EMPTY);
+    ImGui::BeginDisabled(mode == VMMode::EMPTY);
 
     if (ImGui::MenuItem("Pause",   "Ctrl-P")) openPauseScreen = true;
-    if (ImGui::MenuItem("Restart", "Ctrl-R")) m_vm.reset();
+
+    if (ImGui::MenuItem("Restart", "Ctrl-R")) {
+        auto lock = m_emulation.lock();
+        m_vm.reset();
+    }
 
     if (ImGui::MenuItem("Unload ROM")) {
+        auto lock = m_emulation.lock();
         m_vm.unload();
+
         m_showPauseScreen = false;
     }
 
+    if (ImGui::BeginMenu("Quick save")) {
+        for (std::size_t i = 0; i < QUICK_SLOT_COUNT; ++i) {
+            std::string label = "Slot " + std::to_string(i + 1);
+            std::string shortcut = "Shift-F" + std::to_string(i + 1);
+
+            if (ImGui::MenuItem(label.c_str(), shortcut.c_str(), m_quickSlots[i].has_value())) {
+                quickSave(i);
+            }
+        }
+
+        ImGui::EndMenu();
+    }
+
+    if (ImGui::MenuItem("Save state...")) {
+        ImGuiFileDialog::Instance()->OpenDialog("SaveStateDlgKey", "Save state", ".n8s", ".", 1, nullptr,
+                ImGuiFileDialogFlags_Modal | ImGuiFileDialogFlags_ConfirmOverwrite);
+    }
+
+    if (ImGui::BeginMenu("Movie")) {
+        bool moviePlaying = recording || playingBack;
+
+        // Uncapped frames depend on the wall time, so they cannot be replayed
+        if (ImGui::MenuItem("Record", nullptr, false, !moviePlaying && !m_cfg.cpu.uncapCyclesPerSec)) {
+            try {
+                auto lock = m_emulation.lock();
+                m_vm.startRecording(m_movie);
+            } catch (const VMError &err) {
+                showError(err.what());
+            }
+        }
+
+        if (ImGui::MenuItem("Stop and save...", nullptr, false, recording)) {
+            auto lock = m_emulation.lock();
+            m_vm.stopRecording();
+
+            ImGuiFileDialog::Instance()->OpenDialog("SaveMovieDlgKey", "Save movie", ".n8m", ".", 1, nullptr,
+                    ImGuiFileDialogFlags_Modal | ImGuiFileDialogFlags_ConfirmOverwrite);
+        }
+
+        if (ImGui::MenuItem("Play...", nullptr, false, !moviePlaying)) {
+            ImGuiFileDialog::Instance()->OpenDialog("PlayMovieDlgKey", "Choose movie", ".n8m", ".", 1, nullptr,
+                    ImGuiFileDialogFlags_Modal);
+        }
+
+        if (ImGui::MenuItem("Stop playback", nullptr, false, playingBack)) {
+            auto lock = m_emulation.lock();
+            m_vm.stopPlayback();
+        }
+
+        ImGui::EndMenu();
+    }
+
+    if (ImGui::BeginMenu("Quick load")) {
+        for (std::size_t i = 0; i < QUICK_SLOT_COUNT; ++i) {
+            std::string label = "Slot " + std::to_string(i + 1);
+            std::string shortcut = "F" + std::to_string(i + 1);
+
+            if (ImGui::MenuItem(label.c_str(), shortcut.c_str(), false, m_quickSlots[i].has_value())) {
+                quickLoad(i);
+            }
+        }
+
+        ImGui::EndMenu();
+    }
+
+    if (ImGui::MenuItem("Load state...")) {
+        ImGuiFileDialog::Instance()->OpenDialog("LoadStateDlgKey", "Choose save state", ".n8s", ".", 1, nullptr,
+                ImGuiFileDialogFlags_Modal);
+    }
+
+    // A save state belongs to its ROM
     ImGui::EndDisabled();
 
     if (ImGui::MenuItem("Settings"))       m_settings.show = true;
     if (ImGui::MenuItem("About nCHIP-8"))  m_showAbout     = true;
     if (ImGui::MenuItem("Quit", "Ctrl-Q")) m_quitRequested = true;
 
-    if (m_vm.cfg.cpu.debugMode) {
+    if (m_cfg.cpu.debugMode) {
         ImGui::Separator();
 
         menuLabel("DEBUG");
 
-        ImGui::BeginDisabled(m_vm.mode() != VMMode::STEP);
+        ImGui::BeginDisabled(mode != VMMode::STEP);
 
-        if (ImGui::MenuItem("Step",     "Ctrl-S"))       m_vm.step();
-        if (ImGui::MenuItem("Continue", "Ctrl-Shift-C")) m_vm.setMode(VMMode::RUN);
+        if (ImGui::MenuItem("Step", "Ctrl-S")) step();
+
+        if (ImGui::MenuItem("Continue", "Ctrl-Shift-C")) {
+            auto lock = m_emulation.lock();
+            m_vm.setMode(VMMode::RUN);
+        }
 
         ImGui::EndDisabled();
 
@@ -265,25 +396,146 @@ void UI::menu() {
     ImGui::EndPopup();
 
     if (openPauseScreen) {
+        auto lock = m_emulation.lock();
         m_vm.setMode(VMMode::PAUSED);
 
         ImGui::OpenPopup("Pause screen");
     }
 }
 
+void UI::step() {
+    try {
+        auto lock = m_emulation.lock();
+        m_vm.step();
+    } catch (const VMError &err) {
+        showError(err.what());
+    }
+}
+
+void UI::quickSave(std::size_t slot) {
+    auto lock = m_emulation.lock();
+
+    if (m_vm.mode() == VMMode::EMPTY) {
+        return;
+    }
+
+    if (!m_quickSlots[slot]) {
+        m_quickSlots[slot].emplace();
+    }
+
+    m_vm.saveState(*m_quickSlots[slot]);
+}
+
+void UI::quickLoad(std::size_t slot) {
+    if (!m_quickSlots[slot]) {
+        return;
+    }
+
+    try {
+        auto lock = m_emulation.lock();
+        m_vm.loadState(*m_quickSlots[slot]);
+
+        m_settings.reloadQuirks();
+    } catch (const VMError &err) {
+        showError(err.what());
+
+        return;
+    }
+
+    m_showMainMenu = false;
+}
+
+void UI::movieDialogs() {
+    auto *fileDialog = ImGuiFileDialog::Instance();
+
+    try {
+        if (fileDialog->Display("SaveMovieDlgKey", ImGuiWindowFlags_NoCollapse, { 600, 300 })) {
+            if (fileDialog->IsOk()) {
+                m_movie.writeFile(fileDialog->GetFilePathName());
+            }
+
+            fileDialog->Close();
+        }
+
+        if (fileDialog->Display("PlayMovieDlgKey", ImGuiWindowFlags_NoCollapse, { 600, 300 })) {
+            if (fileDialog->IsOk()) {
+                // Read before locking, so the emulation doesn't wait for the disk
+                Movie movie(fileDialog->GetFilePathName());
+
+                auto lock = m_emulation.lock();
+                m_movie = std::move(movie);
+                m_vm.startPlayback(m_movie);
+
+                // The movie brings its own quirks
+                m_settings.reloadQuirks();
+            }
+
+            fileDialog->Close();
+        }
+    } catch (const VMError &err) {
+        fileDialog->Close();
+
+        showError(err.what());
+    }
+}
+
+void UI::saveStateDialogs() {
+    auto *fileDialog = ImGuiFileDialog::Instance();
+
+    try {
+        if (fileDialog->Display("SaveStateDlgKey", ImGuiWindowFlags_NoCollapse, { 600, 300 })) {
+            if (fileDialog->IsOk()) {
+                SaveState save;
+
+                {
+                    auto lock = m_emulation.lock();
+                    m_vm.saveState(save);
+                }
+
+                save.writeFile(fileDialog->GetFilePathName());
+            }
+
+            fileDialog->Close();
+        }
+
+        if (fileDialog->Display("LoadStateDlgKey", ImGuiWindowFlags_NoCollapse, { 600, 300 })) {
+            if (fileDialog->IsOk()) {
+                SaveState save(fileDialog->GetFilePathName());
+
+                {
+                    auto lock = m_emulation.lock();
+                    m_vm.loadState(save);
+
+                    m_settings.reloadQuirks();
+                }
+
+                m_showMainMenu = false;
+            }
+
+            fileDialog->Close();
+        }
+    } catch (const VMError &err) {
+        fileDialog->Close();
+
+        showError(err.what());
+    }
+}
+
 void UI::windows() {
-    if (m_vm.mode() == VMMode::EMPTY && !m_showMainMenu) {
+    if (m_emulation.snapshot().mode == VMMode::EMPTY && !m_showMainMenu) {
         m_showMainMenu = true;
     }
 
     if (m_showMainMenu) mainMenu();
     if (m_showAbout)    about();
 
+    movieDialogs();
+    saveStateDialogs();
+
     m_settings.render();
 
-    if (m_vm.cfg.cpu.debugMode) {
+    if (m_cfg.cpu.debugMode) {
         m_breakpoints.render();
-        m_disassembler.render();
 
         try {
             m_instrExecutor.render();
@@ -292,6 +544,7 @@ void UI::windows() {
         }
 
         m_keypad.render();
+        m_disassembler.render();
         m_registers.render();
         m_stack.render();
     }
@@ -336,6 +589,8 @@ void UI::mainMenu() {
             if (fileDialog->IsOk()) {
                 std::string rom = fileDialog->GetFilePathName();
 
+                auto lock = m_emulation.lock();
+
                 if (m_vm.ext() != ext) {
                     m_vm.setExtension(ext);
                 }
@@ -383,5 +638,23 @@ void UI::about() {
     ImGui::Text("Version: v%s", VERSION.c_str());
     ImGui::Text("Build date: %s %s", __DATE__, __TIME__);
 
+    // The main loop wakes up at least once a second, even when idle. std::clock() is the CPU time of the process
+    // (of all its threads).
+    auto time = std::chrono::steady_clock::now();
+    std::clock_t used = std::clock();
+
+    if (time - m_cpuSampleTime >= std::chrono::seconds(1)) {
+        if (m_cpuSampleTime != std::chrono::steady_clock::time_point()) {
+            std::chrono::duration<double> elapsed = time - m_cpuSampleTime;
+
+            m_cpuUsage = (double) (used - m_cpuSampleUsed) / CLOCKS_PER_SEC / elapsed.count() * 100;
+        }
+
+        m_cpuSampleTime = time;
+        m_cpuSampleUsed = used;
+    }
+
+    ImGui::Text("Host CPU usage: %.1f%% of one core", m_cpuUsage);
+
     ImGui::End();
 }
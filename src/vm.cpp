@@ -3,13 +3,19 @@
 
 #include <nchip8/vm.hpp>
 #include <nchip8/instr_set.hpp>
+#include <nchip8/movie.hpp>
+#include <nchip8/recompiler.hpp>
+#include <nchip8/rewinder.hpp>
 #include <nchip8/utils.hpp>
 
 #include <cstring>
 #include <fstream>
 #include <iomanip>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
+#include <utility>
 
 using namespace nchip8;
 
@@ -27,8 +33,50 @@ StackOverflow::StackOverflow()
 
 }
 
+StackUnderflow::StackUnderflow()
+    : VMError { "return from a subroutine with an empty stack" } {
+
+}
+
+InvalidSaveState::InvalidSaveState()
+    : VMError { "the save state is corrupted or was made by an incompatible version of nCHIP-8" } {
+
+}
+
+InvalidSaveState::InvalidSaveState(const std::string &err)
+    : VMError { err } {
+
+}
+
+std::uint8_t nchip8::packQuirks(const Quirks &quirks) {
+    return (std::uint8_t) (quirks.jumpOffsetUseV0       << 0 |
+                           quirks.wrapPixelsX           << 1 |
+                           quirks.wrapPixelsY           << 2 |
+                           quirks.bitwiseResetVF        << 3 |
+                           quirks.shiftSetVxToVy        << 4 |
+                           quirks.loadSaveIncrementI    << 5 |
+                           quirks.draw8x16SpriteInLores << 6 |
+                           quirks.collisionCountRows    << 7);
+}
+
+Quirks nchip8::unpackQuirks(std::uint8_t bits) {
+    Quirks quirks;
+
+    quirks.jumpOffsetUseV0       = bits & (1 << 0);
+    quirks.wrapPixelsX           = bits & (1 << 1);
+    quirks.wrapPixelsY           = bits & (1 << 2);
+    quirks.bitwiseResetVF        = bits & (1 << 3);
+    quirks.shiftSetVxToVy        = bits & (1 << 4);
+    quirks.loadSaveIncrementI    = bits & (1 << 5);
+    quirks.draw8x16SpriteInLores = bits & (1 << 6);
+    quirks.collisionCountRows    = bits & (1 << 7);
+
+    return quirks;
+}
+
 VMState::VMState() :
-    romSize { 0 } {
+    rplFlags { 0 },
+    romSize  { 0 } {
 
     static const std::uint8_t font[] = {
         0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
@@ -93,62 +141,196 @@ void VMState::reset() {
 
     regs.fill(0);
 
-    while (!stack.empty()) {
-        stack.pop();
-    }
+    sp = 0;
+    stack.fill(0);
+    keys = 0;
+}
 
-    inputTable.reset();
+VM::VM(const CPUConfig &cfg)
+    : cfg { cfg } {
+    state.rng.seed(cfg.rngSeed);
+    state.rplFlags = cfg.rplFlags;
+    loadInstrSet();
 }
 
-VM::VM(Display &display, Config &cfg)
-    : cfg { cfg },
-      display { display },
-      beeper { cfg.sound.waveform, cfg.sound.level, cfg.sound.frequency } {
-    loadInstrSet(m_ext);
+VM::VM(const VM &parent)
+    : state             { parent.state },
+      cfg               { parent.cfg },
+      display           { parent.display },
+      breakpoints       { parent.breakpoints },
+      waitForKeyRelease { parent.waitForKeyRelease },
+      keyToRelease      { parent.keyToRelease },
+      m_dispatchTable   { parent.m_dispatchTable },
+      m_decodeCache     { parent.m_decodeCache },
+      m_lastUpdate      { parent.m_lastUpdate },
+      m_pendingTime     { parent.m_pendingTime },
+      m_cycleRemainder  { parent.m_cycleRemainder },
+      m_cycleCount      { parent.m_cycleCount },
+      m_frameCount      { parent.m_frameCount },
+      m_toneOn          { parent.m_toneOn },
+      m_rom             { parent.m_rom },
+      m_romHash         { parent.m_romHash },
+      m_rngSeed         { parent.m_rngSeed },
+      m_mode            { parent.m_mode },
+      m_prevMode        { parent.m_prevMode },
+      m_ext             { parent.m_ext },
+      m_quirks          { parent.m_quirks } {
 }
 
+VM::~VM() = default;
+
 void VM::update() {
+    // Don't try to catch up with more frames than this (e.g. after the window was being dragged)
+    constexpr std::int64_t MAX_PENDING_FRAMES = 4;
+    constexpr std::int64_t FRAME_LENGTH = 1'000'000'000;
+
     if (m_mode == VMMode::EMPTY) {
         return;
     }
 
-    auto updateTimers = [&](std::uint32_t currentTime) {
-        static std::uint32_t lastlyTimersUpdated = SDL_GetTicks();
-        static int counter = 0;
+    Clock::time_point currentTime = Clock::now();
+    auto deltaTime = std::chrono::duration_cast<std::chrono::nanoseconds>(currentTime - m_lastUpdate);
+    m_lastUpdate = currentTime;
+
+    m_pendingTime = std::min(m_pendingTime + deltaTime.count() * TIMER_FREQ, MAX_PENDING_FRAMES * FRAME_LENGTH);
+
+    if (uncapCyclesPerSec()) {
+        runUncappedSlice();
+    }
+
+    while (m_pendingTime >= FRAME_LENGTH) {
+        m_pendingTime -= FRAME_LENGTH;
+        m_frameEnd = currentTime - std::chrono::nanoseconds(m_pendingTime / TIMER_FREQ);
+
+        runFrame();
+    }
+}
+
+void VM::runFrame(Clock::time_point frameEnd) {
+    if (m_mode == VMMode::EMPTY) {
+        return;
+    }
+
+    m_frameEnd = frameEnd;
+
+    if (uncapCyclesPerSec()) {
+        runUncappedSlice();
+    }
+
+    runFrame();
+}
+
+void VM::runFrame() {
+    if (m_mode == VMMode::EMPTY) {
+        return;
+    }
 
-        std::uint32_t deltaTime = currentTime - lastlyTimersUpdated;
-        counter += deltaTime;
+    simulateFrame();
 
-        while (counter >= TIMER_UPDATE_FREQ) {
-            state.updateTimers();
+    if (audioSink) {
+        audioSink->frame(m_toneOn);
+    }
 
-            counter -= TIMER_UPDATE_FREQ;
-            lastlyTimersUpdated = currentTime;
+    // Paused frames differ only in the timers, they would just push the real history out
+    if (cfg.rewindSeconds > 0 && m_mode == VMMode::RUN) {
+        if (!m_rewinder) {
+            m_rewinder = std::make_unique<Rewinder>(cfg);
         }
-    };
 
-    static std::uint32_t lastlyStepped = SDL_GetTicks();
-    std::uint32_t currentTime = SDL_GetTicks();
-    std::uint32_t deltaTime   = currentTime - lastlyStepped;
-    bool timeToStep = cfg.cpu.uncapCyclesPerSec || deltaTime >= 1000 / cfg.cpu.cyclesPerSec;
+        m_rewinder->capture(*this);
+    }
+
+    // Uncapped frames have no instruction budget to run ahead with
+    if (displaySink && cfg.runAheadFrames > 0 && m_mode == VMMode::RUN && !uncapCyclesPerSec()) {
+        runAhead();
+    } else {
+        present();
+    }
+}
+
+void VM::present() {
+    if (displaySink) {
+        displaySink->present(display);
+        display.clearDirtyRows();
+    }
+}
+
+void VM::simulateFrame() {
+    if (m_mode == VMMode::EMPTY) {
+        return;
+    }
+
+    std::size_t cycles = 0;
+
+    // When uncapped, the instructions are executed as fast as possible before the frame (see runUncappedSlice())
+    if (m_mode == VMMode::RUN && !uncapCyclesPerSec()) {
+        m_cycleRemainder += cyclesPerSec();
+
+        cycles = m_cycleRemainder / TIMER_FREQ;
+        m_cycleRemainder %= TIMER_FREQ;
+    }
+
+    runFrameCycles(cycles);
+
+    // The tone sounds for as many frames as the sound timer was set to
+    m_toneOn = m_mode == VMMode::RUN && state.st > 0;
+    state.updateTimers();
+    ++m_frameCount;
+}
 
-    if (m_mode == VMMode::RUN && timeToStep) {
-        lastlyStepped = currentTime;
+void VM::runUncappedSlice() {
+    // The instructions are executed in batches of this size, so the clock isn't read after every instruction
+    constexpr std::size_t UNCAPPED_BATCH_SIZE = 1024;
+    // Less than a frame, the rest of it is left for the others that need the VM (the UI)
+    constexpr auto UNCAPPED_TIME_SLICE = std::chrono::milliseconds(10);
 
-        if (breakpoints.has(state.pc)) {
+    auto deadline = Clock::now() + UNCAPPED_TIME_SLICE;
+
+    while (m_mode == VMMode::RUN && Clock::now() < deadline) {
+        runCycles(UNCAPPED_BATCH_SIZE);
+    }
+}
+
+std::size_t VM::runCycles(std::size_t n) {
+    // Breakpoints are checked only between instructions, so they can't be used with compiled blocks
+    bool recompile = cfg.useRecompiler && Recompiler::supported() && breakpoints.empty() && !m_speculative;
+
+    if (recompile && !m_recompiler) {
+        m_recompiler = std::make_unique<Recompiler>(*this);
+    }
+
+    std::size_t executed = 0;
+
+    while (executed < n && m_mode == VMMode::RUN) {
+        if (!breakpoints.empty() && breakpoints.has(state.pc)) {
             m_mode = VMMode::STEP;
 
-            return;
+            break;
         }
 
-        step();
-    }
+        std::size_t limit = n - executed;
+
+        // A compiled block must not run past the instruction before which a key changes
+        if (m_playback) {
+            limit = std::min(limit, applyMovieInput());
+        }
 
-    updateTimers(currentTime);
+        if (recompile) {
+            std::size_t blockLength = m_recompiler->run(state.pc, limit);
 
-    if (cfg.sound.enable && m_mode == VMMode::RUN && state.st > 0) {
-        beeper.play();
+            if (blockLength > 0) {
+                executed += blockLength;
+                m_cycleCount += blockLength;
+
+                continue;
+            }
+        }
+
+        step();
+        ++executed;
     }
+
+    return executed;
 }
 
 void VM::step() {
@@ -156,53 +338,101 @@ void VM::step() {
         return;
     }
 
-    // Fetch opcode
-    std::uint16_t opcode = *(const std::uint16_t *const) &state.memory[state.pc];
-    opcode = utils::swapEndianess(opcode); // system endianess agnostic
+    std::uint16_t addr = state.pc & (MEM_SIZE - 1);
+    // A copy, as the instruction may overwrite itself
+    DecodedInstr instr = (*m_decodeCache)[addr];
+
+    if (!instr.impl) {
+        std::uint16_t opcode = fetch(addr);
+
+        instr.impl = (*m_dispatchTable)[opcode];
+        instr.ops  = OperandMap(opcode);
+
+        writableDecodeCache()[addr] = instr;
+    }
 
     state.pc += 2;
 
     try {
-        execInstr(opcode);
+        instr.impl(*this, instr.ops);
     } catch (const VMError &err) {
         m_mode = VMMode::PAUSED;
 
         throw err;
     }
-}
 
-void VM::updateInputTable(const SDL_Event &event) {
-    auto &inputTable = state.inputTable;
-    const auto &keysym = event.key.keysym;
+    ++m_cycleCount;
+}
 
-    if (keysym.mod != KMOD_NONE) {
+void VM::setKey(std::size_t key, bool pressed) {
+    // The keys are fed by the movie
+    if (m_playback) {
         return;
     }
 
-    for (const auto &key : cfg.input.layout) {
-        if (keysym.scancode == key.first) {
-            inputTable[(std::size_t) key.second] = event.type == SDL_KEYDOWN;
+    if (m_recording && state.keyPressed(key) != pressed) {
+        m_recording->events.push_back({ m_cycleCount - m_movieStartCycle, (std::uint8_t) key, pressed });
+    }
 
-            break;
-        }
+    state.setKey(key, pressed);
+}
+
+bool VM::queueKey(std::size_t key, bool pressed, std::chrono::steady_clock::time_point time) {
+    if (key >= KEY_COUNT) {
+        return false;
     }
-};
+
+    return m_keyEvents.push({ time, (std::uint8_t) key, pressed });
+}
 
 void VM::setExtension(Extension ext) {
     m_ext = ext;
 
-    m_instrSet.clear();
-    loadInstrSet(ext);
+    loadInstrSet();
+}
+
+void VM::setQuirks(const Quirks &quirks) {
+    m_quirks = quirks;
+
+    loadInstrSet();
 }
 
 void VM::execInstr(std::uint16_t opcode) {
-    InstrKind instr = decodeOpcode(opcode);
+    (*m_dispatchTable)[opcode](*this, OperandMap(opcode));
+}
+
+void VM::memoryChanged(std::uint16_t addr, std::size_t size) {
+    if (size == 0 || addr >= MEM_SIZE) {
+        return;
+    }
+
+    // The instruction that begins one byte before the range overlaps it too
+    std::size_t begin = (addr + MEM_SIZE - 1) & (MEM_SIZE - 1);
+    std::size_t count = std::min(size + 1, MEM_SIZE);
 
-    Instruction::Impl impl = m_instrSet.at(instr).impl();
-    impl(*this, opcode);
+    for (std::size_t i = 0; i < count; ++i) {
+        std::size_t idx = (begin + i) & (MEM_SIZE - 1);
+
+        // Writes to data (which is never decoded) don't make a shared cache copied
+        if ((*m_decodeCache)[idx].impl) {
+            writableDecodeCache()[idx].impl = nullptr;
+        }
+    }
+
+    if (m_recompiler) {
+        m_recompiler->invalidate(addr, size);
+    }
 }
 
 std::optional<InstrKind> VM::tryDecodeOpcode(std::uint16_t opcode) {
+    return tryDecodeOpcode(opcode, m_ext);
+}
+
+Instruction::Impl VM::handler(std::uint16_t opcode) const {
+    return (*m_dispatchTable)[opcode];
+}
+
+std::optional<InstrKind> VM::tryDecodeOpcode(std::uint16_t opcode, Extension ext) {
     switch (opcode & 0xffff) {
     case 0x00e0: return InstrKind::CLEAR_SCREEN;
     case 0x00ee: return InstrKind::RET;
@@ -249,7 +479,7 @@ std::optional<InstrKind> VM::tryDecodeOpcode(std::uint16_t opcode) {
     case 0xf065: return InstrKind::REG_LOAD;
     }
 
-    if (m_ext == Extension::SCHIP) {
+    if (ext == Extension::SCHIP) {
         if ((opcode & 0xfff0) == 0x00c0) {
             return InstrKind::SCROLL_DOWN;
         }
@@ -272,13 +502,256 @@ std::optional<InstrKind> VM::tryDecodeOpcode(std::uint16_t opcode) {
     return std::nullopt;
 }
 
+void VM::saveState(SaveState &save) const {
+    save.magic   = SaveState::MAGIC;
+    save.version = SaveState::VERSION;
+    save.romHash = m_romHash;
+
+    save.state  = state;
+    save.ext    = m_ext;
+    save.quirks = m_quirks;
+
+    display.copyTo(save.frame);
+    save.res = display.res();
+
+    save.pendingTime    = m_pendingTime;
+    save.cycleRemainder = m_cycleRemainder;
+    save.cycleCount     = m_cycleCount;
+    save.frameCount     = m_frameCount;
+
+    save.waitForKeyRelease = waitForKeyRelease;
+    save.keyToRelease      = (std::uint8_t) keyToRelease;
+}
+
+void VM::loadState(const SaveState &save) {
+    if (save.magic != SaveState::MAGIC || save.version != SaveState::VERSION) {
+        throw InvalidSaveState();
+    }
+
+    // Restart and the movies would use the loaded ROM, not the one the save state was made with
+    if (m_mode == VMMode::EMPTY) {
+        throw InvalidSaveState("no ROM is loaded");
+    }
+
+    if (save.romHash != m_romHash) {
+        throw InvalidSaveState("the save state was made with a different ROM");
+    }
+
+    stopRecording();
+    rollBackTo(save);
+}
+
+void VM::rollBackTo(const SaveState &save) {
+    // Memory compared at once when looking for the instructions to decode again
+    constexpr std::size_t CHUNK_SIZE = 64;
+
+    // Before the state is replaced, as it restores the RPL flags
+    stopPlayback();
+
+    if (save.ext != m_ext || save.quirks != m_quirks) {
+        m_ext = save.ext;
+        m_quirks = save.quirks;
+
+        loadInstrSet();
+    }
+
+    // Usually only a small part of the memory differs (e.g. when rewinding), so decode again just that part
+    for (std::size_t addr = 0; addr < MEM_SIZE; addr += CHUNK_SIZE) {
+        if (std::memcmp(&state.memory[addr], &save.state.memory[addr], CHUNK_SIZE) != 0) {
+            memoryChanged((std::uint16_t) addr, CHUNK_SIZE);
+        }
+    }
+
+    state = save.state;
+
+    display.restore(save.frame, save.res);
+    display.wrapPixelsX = m_quirks.wrapPixelsX;
+    display.wrapPixelsY = m_quirks.wrapPixelsY;
+
+    m_pendingTime    = save.pendingTime;
+    m_cycleRemainder = save.cycleRemainder;
+    m_cycleCount     = save.cycleCount;
+    m_frameCount     = save.frameCount;
+    m_lastUpdate     = Clock::now();
+
+    waitForKeyRelease = save.waitForKeyRelease;
+    keyToRelease      = save.keyToRelease;
+
+    // Going back while recording discards the input made after that point
+    if (m_recording) {
+        if (m_cycleCount < m_movieStartCycle || m_frameCount < m_movieStartFrame) {
+            stopRecording();
+        } else {
+            auto &events = m_recording->events;
+            std::uint64_t now = m_cycleCount - m_movieStartCycle;
+
+            while (!events.empty() && events.back().cycle >= now) {
+                events.pop_back();
+            }
+
+            // The restored keypad may differ from the one the remaining events lead to (the save state could be
+            // taken after a key change in the same cycle), so record the difference
+            std::uint16_t keys = 0;
+
+            for (const auto &event : events) {
+                keys = (std::uint16_t) (event.pressed ? keys | 1 << event.key : keys & ~(1 << event.key));
+            }
+
+            for (std::uint8_t key = 0; key < KEY_COUNT; ++key) {
+                if (((keys >> key) & 1) != state.keyPressed(key)) {
+                    events.push_back({ now, key, state.keyPressed(key) });
+                }
+            }
+        }
+    }
+
+    present();
+}
+
+bool VM::rewind() {
+    std::uint16_t keys = state.keys;
+
+    if (!m_rewinder || !m_rewinder->rewind(*this)) {
+        return false;
+    }
+
+    // Otherwise the keys held by the player would jump to the ones held back then. Through setKey(), so a movie
+    // being recorded gets the difference too.
+    for (std::size_t key = 0; key < KEY_COUNT; ++key) {
+        setKey(key, keys >> key & 1);
+    }
+
+    return true;
+}
+
+void VM::startRecording(Movie &movie) {
+    if (m_mode == VMMode::EMPTY) {
+        throw MovieError("no ROM is loaded");
+    }
+
+    if (cfg.uncapCyclesPerSec) {
+        throw MovieError("movies cannot be recorded with uncapped cycles/sec");
+    }
+
+    stopRecording();
+
+    movie = Movie();
+    movie.romHash      = m_romHash;
+    movie.ext          = m_ext;
+    movie.quirks       = m_quirks;
+    movie.rngSeed      = rngSeed();
+    movie.cyclesPerSec = cfg.cyclesPerSec;
+    movie.rplFlags     = state.rplFlags;
+
+    m_recording = &movie;
+
+    reset();
+}
+
+void VM::stopRecording() {
+    if (!m_recording) {
+        return;
+    }
+
+    m_recording->frameCount = m_frameCount - m_movieStartFrame;
+    m_recording->finalDisplayHash = display.hash();
+    m_recording = nullptr;
+}
+
+void VM::startPlayback(const Movie &movie) {
+    if (m_mode == VMMode::EMPTY) {
+        throw MovieError("no ROM is loaded");
+    }
+
+    if (movie.romHash != m_romHash) {
+        throw MovieError("the movie was recorded with a different ROM");
+    }
+
+    stopRecording();
+    stopPlayback();
+    reloadRom();
+
+    m_extBeforePlayback = m_ext;
+    m_quirksBeforePlayback = m_quirks;
+
+    m_ext = movie.ext;
+    m_quirks = movie.quirks;
+    loadInstrSet();
+
+    display.wrapPixelsX = m_quirks.wrapPixelsX;
+    display.wrapPixelsY = m_quirks.wrapPixelsY;
+
+    reset();
+
+    // The cycles/sec are taken from the movie by cyclesPerSec()
+    state.rng.seed(movie.rngSeed);
+    m_rplFlagsBeforePlayback = state.rplFlags;
+    state.rplFlags = movie.rplFlags;
+
+    m_playback = &movie;
+    m_playbackPos = 0;
+    m_movieStartCycle = m_cycleCount;
+    m_movieStartFrame = m_frameCount;
+}
+
+void VM::stopPlayback() {
+    if (!m_playback) {
+        return;
+    }
+
+    state.rplFlags = m_rplFlagsBeforePlayback;
+    m_playback = nullptr;
+
+    if (m_ext != m_extBeforePlayback || m_quirks != m_quirksBeforePlayback) {
+        m_ext = m_extBeforePlayback;
+        m_quirks = m_quirksBeforePlayback;
+        loadInstrSet();
+
+        display.wrapPixelsX = m_quirks.wrapPixelsX;
+        display.wrapPixelsY = m_quirks.wrapPixelsY;
+    }
+}
+
+bool VM::recording() const {
+    return m_recording;
+}
+
+bool VM::playingBack() const {
+    return m_playback;
+}
+
+std::uint64_t VM::romHash() const {
+    return m_romHash;
+}
+
+void VM::overrideRngSeed(std::optional<unsigned> seed) {
+    m_rngSeed = seed;
+}
+
+std::unique_ptr<VM> VM::fork() const {
+    // The constructor is private, so std::make_unique() cannot be used
+    return std::unique_ptr<VM>(new VM(*this));
+}
+
 void VM::load(std::vector<std::uint8_t> rom) {
     if (rom.size() > PROG_MAX_SIZE) {
         throw std::length_error("Size of program must be <= " + std::to_string(PROG_MAX_SIZE) + " bytes");
     }
 
     std::memcpy(&state.memory[PROG_OFFSET], rom.data(), rom.size());
-    state.romSize = rom.size();
+    state.romSize = (std::uint16_t) rom.size();
+    flushDecodeCache();
+
+    stopRecording();
+
+    // FNV-1a
+    m_romHash = 0xcbf29ce484222325;
+
+    for (std::uint8_t byte : rom) {
+        m_romHash = (m_romHash ^ byte) * 0x100000001b3;
+    }
+
+    m_rom = std::make_shared<const std::vector<std::uint8_t>>(std::move(rom));
 
     reset();
 }
@@ -308,14 +781,48 @@ void VM::loadFile(const std::string &filename) {
 
 void VM::reset() {
     state.reset();
+    state.rng.seed(rngSeed());
+    waitForKeyRelease = false;
+    keyToRelease = 0;
+    m_cycleRemainder = 0;
+
+    if (m_rewinder) {
+        m_rewinder->clear();
+    }
+
+    // A movie must start at a reset, so the recording starts over
+    if (m_recording) {
+        reloadRom();
+
+        m_recording->events.clear();
+        m_recording->rplFlags = state.rplFlags;
+        m_movieStartCycle = m_cycleCount;
+        m_movieStartFrame = m_frameCount;
+    }
+
+    stopPlayback();
+
     display.clear();
     display.setResolution(Resolution::LOW);
+
+    present();
+}
+
+void VM::restart() {
+    reloadRom();
+    reset();
 }
 
 void VM::unload() {
+    // EXIT (00FD) ends the recording, before the display is cleared
+    stopRecording();
+
     // Fill memory with zeros except for the font space
-    std::memset(&state.memory[BIG_FONT_MEM_SIZE], 0, MEM_SIZE - BIG_FONT_MEM_SIZE);
+    std::memset(&state.memory[FONTS_END], 0, MEM_SIZE - FONTS_END);
     state.romSize = 0;
+    m_rom.reset();
+    m_romHash = 0;
+    flushDecodeCache();
     reset();
 
     setMode(VMMode::EMPTY);
@@ -413,7 +920,7 @@ std::string VM::disassemble(std::uint16_t opcode) {
     case InstrKind::JUMP_OFFSET:
         str << "jump " << utils::toHexPrefixed(ops.addr) << " + ";
 
-        if (quirks.jumpOffsetUseV0) {
+        if (m_quirks.jumpOffsetUseV0) {
             str << "V0";
         } else {
             str << xReg;
@@ -534,6 +1041,26 @@ Extension VM::ext() const {
     return m_ext;
 }
 
+const Quirks &VM::quirks() const {
+    return m_quirks;
+}
+
+std::uint64_t VM::cycleCount() const {
+    return m_cycleCount;
+}
+
+std::uint64_t VM::frameCount() const {
+    return m_frameCount;
+}
+
+bool VM::toneOn() const {
+    return m_toneOn;
+}
+
+std::chrono::nanoseconds VM::runAheadTime() const {
+    return m_runAheadTime;
+}
+
 InstrKind VM::decodeOpcode(std::uint16_t opcode) {
     auto kind = tryDecodeOpcode(opcode);
 
@@ -546,10 +1073,228 @@ InstrKind VM::decodeOpcode(std::uint16_t opcode) {
     return kind.value();
 }
 
-void VM::loadInstrSet(Extension ext) {
+void VM::loadInstrSet() {
+    m_dispatchTable = &dispatchTable(m_quirks, m_ext);
+
+    // The decoded instructions (and the compiled code) point to the handlers of the previous table
+    flushDecodeCache();
+}
+
+std::uint16_t VM::fetch(std::uint16_t addr) const {
+    // Opcodes are stored in big-endian
+    auto msb = (std::uint16_t) (state.memory[addr & (MEM_SIZE - 1)] << 8);
+    auto lsb = (std::uint16_t)  state.memory[(addr + 1) & (MEM_SIZE - 1)];
+
+    return msb | lsb;
+}
+
+unsigned VM::cyclesPerSec() const {
+    if (m_recording) {
+        return m_recording->cyclesPerSec;
+    }
+
+    return m_playback ? m_playback->cyclesPerSec : cfg.cyclesPerSec;
+}
+
+bool VM::uncapCyclesPerSec() const {
+    return !m_recording && !m_playback && cfg.uncapCyclesPerSec;
+}
+
+unsigned VM::rngSeed() const {
+    if (m_recording) {
+        return m_recording->rngSeed;
+    }
+
+    return m_rngSeed.value_or(cfg.rngSeed);
+}
+
+std::size_t VM::applyMovieInput() {
+    const auto &events = m_playback->events;
+    std::uint64_t now = m_cycleCount - m_movieStartCycle;
+
+    while (m_playbackPos < events.size() && events[m_playbackPos].cycle <= now) {
+        state.setKey(events[m_playbackPos].key, events[m_playbackPos].pressed);
+        ++m_playbackPos;
+    }
+
+    if (m_playbackPos == events.size()) {
+        return SIZE_MAX;
+    }
+
+    return (std::size_t) (events[m_playbackPos].cycle - now);
+}
+
+void VM::runAhead() {
+    // The average is exponential, the last frame weighs 1/TIME_SMOOTHING
+    constexpr int TIME_SMOOTHING = 16;
+
+    auto start = Clock::now();
+
+    // The speculative frames are neither shown nor heard (the future has no sinks), and they can't change anything
+    // outside the future either: the config is read-only, the RPL flags saved by FX75 stay in its state, and it has no
+    // movie to record into or rewind history to capture into. It's reused, so only the memory that changed since the
+    // previous run-ahead is decoded again and nothing is allocated.
+    if (!m_future) {
+        m_future = fork();
+        m_future->m_speculative = true;
+    }
+
+    VM &future = *m_future;
+    SaveState save;
+    saveState(save);
+
+    // The movie is only lent to it, so it isn't stopped with stopPlayback(): the settings come from the save state
+    future.m_playback = nullptr;
+    future.rollBackTo(save);
+    future.m_mode = m_mode;
+
+    // The movie keeps pressing the keys and setting the speed in the future too. The one being recorded has no events
+    // ahead of the present, so the keys stay as they are.
+    if (m_playback) {
+        future.m_playback = m_playback;
+        future.m_playbackPos = m_playbackPos;
+    } else if (m_recording) {
+        future.m_playback = m_recording;
+        future.m_playbackPos = m_recording->events.size();
+    }
+
+    future.m_movieStartCycle = m_movieStartCycle;
+
+    try {
+        for (unsigned i = 0; i < cfg.runAheadFrames && future.m_mode == VMMode::RUN; ++i) {
+            future.simulateFrame();
+        }
+    } catch (const VMError &) {
+        // The error will occur (and be reported) in this VM as well, when the time comes
+    }
+
+    // The rows changed since the previous run-ahead aren't tracked anywhere, so the sink must check all of them
+    Display &shown = future.m_mode == VMMode::EMPTY ? display : future.display; // EXIT clears the future's display
+    shown.markAllRowsDirty();
+
+    displaySink->present(shown);
+    display.clearDirtyRows();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+    m_runAheadTime += (elapsed - m_runAheadTime) / TIME_SMOOTHING;
+}
+
+void VM::runFrameCycles(std::size_t cycles) {
+    Clock::time_point frameStart = m_frameEnd - FRAME_DURATION;
+    std::size_t executed = 0;
+    KeyEvent event;
+
+    // The events older than the frame (e.g. while the VM was paused) are applied right at its start, the newer ones
+    // wait for their frame
+    while (m_keyEvents.peek(event)) {
+        Clock::time_point time = keyEventTime(event);
+
+        if (time >= m_frameEnd) {
+            break;
+        }
+
+        if (time > frameStart) {
+            auto offset = std::chrono::duration_cast<std::chrono::nanoseconds>(time - frameStart);
+            auto at = (std::size_t) ((std::uint64_t) offset.count() * cycles / (std::uint64_t) FRAME_DURATION.count());
+
+            if (at > executed) {
+                executed += runCycles(at - executed);
+            }
+        }
+
+        if (event.pressed) {
+            m_keyPressTimes[event.key] = event.time;
+        }
+
+        setKey(event.key, event.pressed);
+        m_keyEvents.pop();
+    }
+
+    if (executed < cycles) {
+        runCycles(cycles - executed);
+    }
+}
+
+VM::Clock::time_point VM::keyEventTime(const KeyEvent &event) const {
+    // A release that comes sooner than a frame after the press is postponed, so the games that check the keys once
+    // per frame don't miss the press
+    if (!event.pressed) {
+        return std::max(event.time, m_keyPressTimes[event.key] + FRAME_DURATION);
+    }
+
+    return event.time;
+}
+
+void VM::reloadRom() {
+    std::memset(&state.memory[FONTS_END], 0, MEM_SIZE - FONTS_END);
+    if (m_rom) {
+        std::memcpy(&state.memory[PROG_OFFSET], m_rom->data(), m_rom->size());
+    }
+
+    state.romSize = m_rom ? (std::uint16_t) m_rom->size() : 0;
+    flushDecodeCache();
+}
+
+DecodeCache &VM::writableDecodeCache() {
+    if (m_decodeCache.use_count() > 1) {
+        m_decodeCache = std::make_shared<DecodeCache>(*m_decodeCache);
+    }
+
+    return *m_decodeCache;
+}
+
+void VM::flushDecodeCache() {
+    // Don't clear the cache of the forks, just stop sharing it
+    if (m_decodeCache && m_decodeCache.use_count() == 1) {
+        m_decodeCache->fill({ });
+    } else {
+        m_decodeCache = std::make_shared<DecodeCache>();
+    }
+
+    if (m_recompiler) {
+        m_recompiler->flush();
+    }
+}
+
+const DispatchTable &VM::dispatchTable(const Quirks &quirks, Extension ext) {
     using namespace instr_set_impls;
 
-    static const Instruction instrs[] = {
+    // Only the quirks that change the behavior of the handlers make up the profile. The 8x16 sprites and the row
+    // collisions quirks don't matter without SCHIP, so they aren't included there.
+    bool schip = ext == Extension::SCHIP;
+    bool draw8x16 = schip && quirks.draw8x16SpriteInLores;
+    bool rowCollisions = schip && quirks.collisionCountRows;
+
+    std::size_t profile = (std::size_t) quirks.bitwiseResetVF
+                        | (std::size_t) quirks.shiftSetVxToVy     << 1
+                        | (std::size_t) quirks.jumpOffsetUseV0    << 2
+                        | (std::size_t) quirks.loadSaveIncrementI << 3
+                        | (std::size_t) draw8x16                  << 4
+                        | (std::size_t) schip                     << 5
+                        | (std::size_t) rowCollisions             << 6;
+
+    static std::array<std::unique_ptr<const DispatchTable>, 128> tables;
+    static std::mutex tablesMutex;
+
+    std::lock_guard lock(tablesMutex);
+    auto &table = tables[profile];
+
+    if (table) {
+        return *table;
+    }
+
+    auto pick = [](bool quirk, Instruction::Impl enabled, Instruction::Impl disabled) {
+        return quirk ? enabled : disabled;
+    };
+
+    Instruction::Impl drawSprite = !schip
+        ? drawSprite_impl<Extension::NONE, false, false>
+        : draw8x16 ? pick(rowCollisions, drawSprite_impl<Extension::SCHIP, true, true>,
+                                         drawSprite_impl<Extension::SCHIP, true, false>)
+                   : pick(rowCollisions, drawSprite_impl<Extension::SCHIP, false, true>,
+                                         drawSprite_impl<Extension::SCHIP, false, false>);
+
+    const Instruction instrs[] = {
         Instruction(InstrKind::CLEAR_SCREEN,        clearScreen_impl),
         Instruction(InstrKind::RET,                 ret_impl),
         Instruction(InstrKind::JUMP,                jump_impl),
@@ -560,19 +1305,19 @@ void VM::loadInstrSet(Extension ext) {
         Instruction(InstrKind::LOAD_BYTE,           loadByte_impl),
         Instruction(InstrKind::ADD,                 add_impl),
         Instruction(InstrKind::LOAD_REG,            loadReg_impl),
-        Instruction(InstrKind::OR,                  or_impl),
-        Instruction(InstrKind::AND,                 and_impl),
-        Instruction(InstrKind::XOR,                 xor_impl),
+        Instruction(InstrKind::OR,                  pick(quirks.bitwiseResetVF, or_impl<true>, or_impl<false>)),
+        Instruction(InstrKind::AND,                 pick(quirks.bitwiseResetVF, and_impl<true>, and_impl<false>)),
+        Instruction(InstrKind::XOR,                 pick(quirks.bitwiseResetVF, xor_impl<true>, xor_impl<false>)),
         Instruction(InstrKind::ADD_REG,             addReg_impl),
         Instruction(InstrKind::SUB_REG,             subReg_impl),
-        Instruction(InstrKind::RSHIFT,              rshift_impl),
+        Instruction(InstrKind::RSHIFT,              pick(quirks.shiftSetVxToVy, rshift_impl<true>, rshift_impl<false>)),
         Instruction(InstrKind::LOAD_AND_SUB_REG,    loadAndSubReg_impl),
-        Instruction(InstrKind::LSHIFT,              lshift_impl),
+        Instruction(InstrKind::LSHIFT,              pick(quirks.shiftSetVxToVy, lshift_impl<true>, lshift_impl<false>)),
         Instruction(InstrKind::SKIP_REGS_NOT_EQUAL, skipRegsNotEqual_impl),
         Instruction(InstrKind::LOAD_I,              loadI_impl),
-        Instruction(InstrKind::JUMP_OFFSET,         jumpOffset_impl),
+        Instruction(InstrKind::JUMP_OFFSET,         pick(quirks.jumpOffsetUseV0, jumpOffset_impl<true>, jumpOffset_impl<false>)),
         Instruction(InstrKind::RANDOM,              random_impl),
-        Instruction(InstrKind::DRAW_SPRITE,         drawSprite_impl),
+        Instruction(InstrKind::DRAW_SPRITE,         drawSprite),
         Instruction(InstrKind::SKIP_PRESSED,        skipPressed_impl),
         Instruction(InstrKind::SKIP_NOT_PRESSED,    skipNotPressed_impl),
         Instruction(InstrKind::LOAD_DT,             loadDT_impl),
@@ -582,29 +1327,39 @@ void VM::loadInstrSet(Extension ext) {
         Instruction(InstrKind::ADD_I,               addI_impl),
         Instruction(InstrKind::FONT_CHAR,           fontChar_impl),
         Instruction(InstrKind::BCD,                 bcd_impl),
-        Instruction(InstrKind::REG_DUMP,            regDump_impl),
-        Instruction(InstrKind::REG_LOAD,            regLoad_impl)
+        Instruction(InstrKind::REG_DUMP,            pick(quirks.loadSaveIncrementI, regDump_impl<true>, regDump_impl<false>)),
+        Instruction(InstrKind::REG_LOAD,            pick(quirks.loadSaveIncrementI, regLoad_impl<true>, regLoad_impl<false>)),
+
+        // SCHIP instructions
+        Instruction(InstrKind::HIRES,               hires_impl),
+        Instruction(InstrKind::LORES,               lores_impl),
+        Instruction(InstrKind::SCROLL_DOWN,         scrollDown_impl),
+        Instruction(InstrKind::SCROLL_RIGHT,        scrollRight_impl),
+        Instruction(InstrKind::SCROLL_LEFT,         scrollLeft_impl),
+        Instruction(InstrKind::BIG_FONT_CHAR,       bigFontChar_impl),
+        Instruction(InstrKind::SAVE_FLAGS,          saveFlags_impl),
+        Instruction(InstrKind::LOAD_FLAGS,          loadFlags_impl),
+        Instruction(InstrKind::EXIT,                exit_impl)
     };
 
-    static const Instruction schipInstrs[] = {
-        Instruction(InstrKind::HIRES, hires_impl),
-        Instruction(InstrKind::LORES, lores_impl),
-        Instruction(InstrKind::SCROLL_DOWN, scrollDown_impl),
-        Instruction(InstrKind::SCROLL_RIGHT, scrollRight_impl),
-        Instruction(InstrKind::SCROLL_LEFT, scrollLeft_impl),
-        Instruction(InstrKind::BIG_FONT_CHAR, bigFontChar_impl),
-        Instruction(InstrKind::SAVE_FLAGS, saveFlags_impl),
-        Instruction(InstrKind::LOAD_FLAGS, loadFlags_impl),
-        Instruction(InstrKind::EXIT, exit_impl),
-    };
+    std::array<Instruction::Impl, INSTR_KIND_COUNT> impls {};
 
     for (const auto &instr : instrs) {
-        m_instrSet.insert({ instr.kind(), instr });
+        impls[(std::size_t) instr.kind()] = instr.impl();
     }
 
-    if (ext == Extension::SCHIP) {
-        for (const auto &instr : schipInstrs) {
-            m_instrSet.insert({ instr.kind(), instr });
-        }
+    auto newTable = std::make_unique<DispatchTable>();
+
+    // The decoder already knows which instructions are supported by the extension, so the opcodes of unsupported
+    // ones end up in the invalid handler.
+    for (std::size_t opcode = 0; opcode < OPCODE_COUNT; ++opcode) {
+        auto kind = tryDecodeOpcode((std::uint16_t) opcode, ext);
+
+        (*newTable)[opcode] = kind ? impls[(std::size_t) kind.value()] : invalidOpcode_impl;
     }
+
+    // Tables are built on the first use of the profile and are shared by all VMs
+    table = std::move(newTable);
+
+    return *table;
 }
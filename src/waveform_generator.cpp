@@ -9,6 +9,7 @@
 //   Saw wave:    https://en.wikipedia.org/wiki/Sawtooth_wave
 //   Sine wave:   https://en.wikipedia.org/wiki/Sine_wave
 //   Square wave: https://en.wikipedia.org/wiki/Square_wave
+//   Numerically-controlled oscillator: https://en.wikipedia.org/wiki/Numerically-controlled_oscillator
 
 #include <algorithm>
 // On some older platforms this define is needed for the PI constant
@@ -17,66 +18,77 @@
 
 using namespace nchip8;
 
-namespace {
-    inline sdl::AudioSpec createSpec(int sampleRate, int sampleCount) {
-        return { sampleRate, AUDIO_S16LSB, 1, (std::uint16_t) sampleCount };
-    }
+WaveformGenerator::WaveformGenerator(Waveform waveform, double level, int frequency) {
+    changeWaveform(waveform);
+    setLevel(level);
+    setFrequency(frequency);
 }
 
-WaveformGenerator::WaveformGenerator(Waveform waveform, double level, int frequency)
-    : level     { level },
-      frequency { frequency },
-      m_audioDevice { sdl::NullOpt, 0, createSpec(SAMPLE_RATE, BUFFER_SIZE), 0 } {
-    changeWaveform(waveform);
-    m_audioDevice.Pause(false);
+void WaveformGenerator::generate(std::int16_t *samples, std::size_t count) {
+    const std::int16_t *table = m_table->data();
+    std::uint32_t phase = m_phase;
+    std::uint32_t step = m_phaseStep;
+    std::int32_t gain = m_gain;
+
+    // The phase of each sample is computed from the first one, so there is no dependency between the iterations
+    for (std::size_t i = 0; i < count; ++i) {
+        std::uint32_t samplePhase = phase + (std::uint32_t) i * step;
+        std::int32_t sample = table[samplePhase >> (32 - TABLE_BITS)] * gain >> 15;
+
+        samples[i] = (std::int16_t) std::clamp(sample, INT16_MIN, INT16_MAX);
+    }
+
+    m_phase = phase + (std::uint32_t) count * step;
 }
 
-void WaveformGenerator::play() {
-    auto clip = [](double x, double max, double min) -> double {
-        return std::max(min, std::min(x, max));
-    };
+void WaveformGenerator::changeWaveform(Waveform waveform) {
+    m_waveform = waveform;
+    m_table = &table(waveform);
+}
 
-    auto dBToAmplitude = [](double dB) -> double {
-        return std::pow(10, dB / 20);
-    };
+void WaveformGenerator::setLevel(double level) {
+    // Since our samples are generated in the range [-1; 1], we need increate it to make them audible.
+    constexpr double GAIN = 1000.0;
 
-    double amplitude = dBToAmplitude(level);
+    m_level = level;
 
-    while (m_audioDevice.GetQueuedAudioSize() < BUFFER_SIZE * 2) {
-        for (std::size_t i = 0; i < BUFFER_SIZE; ++i) {
-            // Since our samples are generated in the range [-1; 1], we need increate it to make them audible.
-            constexpr double GAIN = 1000.0;
+    double amplitude = std::pow(10, level / 20) * GAIN;
 
-            double sample = clip(amplitude * GAIN * nextSample(), INT16_MAX, INT16_MIN);
-            m_buf[i] = (std::int16_t) sample;
+    // Twice the full scale is already clipped to a square wave; more would overflow the multiplication
+    m_gain = (std::int32_t) std::clamp(std::lround(amplitude), 0l, (long) UINT16_MAX);
+}
 
-            ++m_sampleCount;
-        }
+void WaveformGenerator::setFrequency(int frequency) {
+    m_frequency = frequency;
+    m_phaseStep = (std::uint32_t) std::llround(std::max(frequency, 0) * 4294967296.0 / SAMPLE_RATE);
+}
 
-        m_audioDevice.QueueAudio(m_buf.data(), BUFFER_SIZE * 2);
-    }
+double WaveformGenerator::level() const {
+    return m_level;
 }
 
-void WaveformGenerator::changeWaveform(Waveform waveform) {
-    m_waveform = waveform;
-    m_sampleCount = 0;
+int WaveformGenerator::frequency() const {
+    return m_frequency;
 }
 
-double WaveformGenerator::nextSample() const {
-    auto freqToAngular = [](double f) -> double {
-        return 2 * M_PI * f;
-    };
+const WaveformGenerator::Table &WaveformGenerator::table(Waveform waveform) {
+    static const std::array<Table, 3> tables = []() {
+        std::array<Table, 3> tables;
 
-    double t = (double) m_sampleCount / SAMPLE_RATE;
+        for (std::size_t i = 0; i < TABLE_SIZE; ++i) {
+            double t = (double) i / TABLE_SIZE;
 
-    switch (m_waveform) {
-    case Waveform::SINE:
-        return std::sin(freqToAngular(frequency) * t);
-    case Waveform::SQUARE:
-        return std::pow(-1, std::floor(2 * frequency * t));
-    case Waveform::SAW:
-        double period = t / (1.0 / frequency);
+            double sine = std::sin(2 * M_PI * t);
+            double square = t < 0.5 ? 1 : -1;
+            double saw = 2 * (t - std::floor(0.5 + t));
 
-        return 2 * ((period - std::floor(0.5 + period)));
-    }
+            tables[(std::size_t) Waveform::SINE][i]   = (std::int16_t) std::lround(sine * INT16_MAX);
+            tables[(std::size_t) Waveform::SQUARE][i] = (std::int16_t) std::lround(square * INT16_MAX);
+            tables[(std::size_t) Waveform::SAW][i]    = (std::int16_t) std::lround(saw * INT16_MAX);
+        }
+
+        return tables;
+    }();
+
+    return tables[(std::size_t) waveform];
 }
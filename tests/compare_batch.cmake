@@ -0,0 +1,36 @@
+# Copyright (c) 2024 inunix3.
+# This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+# Runs nchip8-batch over a ROM list with the interpreter and then with the recompiler. Fails if either run fails or
+# if they differ in any executed instruction count, frame count or framebuffer hash.
+#
+# Usage: cmake -DBATCH=<nchip8-batch> -DLIST=<ROM list> -P compare_batch.cmake
+
+foreach (VAR BATCH LIST)
+    if (NOT DEFINED ${VAR})
+        message(FATAL_ERROR "${VAR} is not set")
+    endif()
+endforeach()
+
+# Enough instructions per frame for the hot blocks to be compiled and run many times
+set(OPTIONS -c 100000 -f 600)
+
+execute_process(COMMAND "${BATCH}" ${OPTIONS} "${LIST}"
+                RESULT_VARIABLE INTERPRETER_RESULT OUTPUT_VARIABLE INTERPRETER_OUTPUT)
+execute_process(COMMAND "${BATCH}" ${OPTIONS} -r "${LIST}"
+                RESULT_VARIABLE RECOMPILER_RESULT OUTPUT_VARIABLE RECOMPILER_OUTPUT)
+
+if (NOT INTERPRETER_RESULT EQUAL 0)
+    message(FATAL_ERROR "the interpreter failed:\n${INTERPRETER_OUTPUT}")
+endif()
+
+if (NOT RECOMPILER_RESULT EQUAL 0)
+    message(FATAL_ERROR "the recompiler failed:\n${RECOMPILER_OUTPUT}")
+endif()
+
+if (NOT INTERPRETER_OUTPUT STREQUAL RECOMPILER_OUTPUT)
+    message(FATAL_ERROR "the recompiler differs from the interpreter\n"
+                        "interpreter:\n${INTERPRETER_OUTPUT}\nrecompiler:\n${RECOMPILER_OUTPUT}")
+endif()
+
+message("${INTERPRETER_OUTPUT}")
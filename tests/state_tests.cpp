@@ -0,0 +1,214 @@
+// Copyright (c) 2024 inunix3.
+// This file is distributed under the MIT license (https://opensource.org/license/mit/)
+
+// nchip8-state-tests: checks that the save states come back unchanged from the places they are stored in.
+//
+// Usage: nchip8-state-tests <test> <ROM> [schip]
+//
+// The tests are:
+//   save-state-file  a save state written to a file and read back is the same, and a VM that loads it continues
+//                    exactly as the one it was taken from
+//   rewind           every frame rewound to is the same as it was when it was emulated (the history is stored as
+//                    keyframes and deltas, so this checks both of them)
+
+#include <nchip8/vm.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace nchip8;
+
+namespace {
+    constexpr unsigned FRAMES = 200;
+    const std::string SAVE_STATE_PATH = "state_tests.n8s";
+
+    void check(bool condition, const std::string &what) {
+        if (!condition) {
+            throw std::runtime_error(what);
+        }
+    }
+
+    // Rewinding keeps the keys held now, so they may be left out of the comparison
+    void checkSame(const SaveState &a, const SaveState &b, bool compareKeys, const std::string &where) {
+        check(a.romHash == b.romHash, where + ": the ROM hash differs");
+        check(a.ext == b.ext && a.quirks == b.quirks, where + ": the extension or the quirks differ");
+
+        check(a.state.regs == b.state.regs && a.state.pc == b.state.pc && a.state.i == b.state.i,
+              where + ": the registers differ");
+        check(a.state.dt == b.state.dt && a.state.st == b.state.st, where + ": the timers differ");
+        check(a.state.sp == b.state.sp && a.state.stack == b.state.stack, where + ": the stack differs");
+        check(!compareKeys || a.state.keys == b.state.keys, where + ": the keys differ");
+        check(a.state.rng == b.state.rng, where + ": the PRNG differs");
+        check(a.state.rplFlags == b.state.rplFlags, where + ": the RPL flags differ");
+        check(a.state.romSize == b.state.romSize && a.state.memory == b.state.memory, where + ": the memory differs");
+
+        // Only the lines of the current resolution are shown (and saved)
+        std::size_t lineCount = (std::size_t) (a.res == Resolution::HIGH ? HIRES_DISPLAY_SIZE.y : LORES_DISPLAY_SIZE.y);
+        bool sameFrame = a.res == b.res;
+
+        for (std::size_t y = 0; sameFrame && y < lineCount; ++y) {
+            sameFrame = a.frame[y] == b.frame[y];
+        }
+
+        check(sameFrame, where + ": the framebuffer differs");
+
+        check(a.pendingTime == b.pendingTime && a.cycleRemainder == b.cycleRemainder &&
+              a.cycleCount == b.cycleCount && a.frameCount == b.frameCount, where + ": the timing differs");
+        check(a.waitForKeyRelease == b.waitForKeyRelease && a.keyToRelease == b.keyToRelease,
+              where + ": the state of FX0A differs");
+    }
+
+    // The keys change pseudo-randomly, but the same for every VM
+    void pressKeys(VM &vm, std::minstd_rand &keys) {
+        if (keys() % 4 == 0) {
+            vm.setKey(keys() % KEY_COUNT, keys() % 2);
+        }
+    }
+
+    void testSaveStateFile(VM &vm, const std::vector<std::uint8_t> &rom, const CPUConfig &cfg) {
+        std::minstd_rand keys;
+
+        for (unsigned i = 0; i < FRAMES; ++i) {
+            pressKeys(vm, keys);
+            vm.runFrame();
+        }
+
+        SaveState saved;
+        vm.saveState(saved);
+        saved.writeFile(SAVE_STATE_PATH);
+
+        SaveState loaded(SAVE_STATE_PATH);
+        checkSame(saved, loaded, true, "after reading the file");
+
+        VM copy(cfg);
+        copy.setExtension(vm.ext());
+        copy.load(rom);
+        copy.setMode(VMMode::RUN);
+        copy.loadState(loaded);
+
+        std::minstd_rand copyKeys = keys;
+
+        for (unsigned i = 0; i < FRAMES; ++i) {
+            pressKeys(vm, keys);
+            pressKeys(copy, copyKeys);
+            vm.runFrame();
+            copy.runFrame();
+
+            SaveState a;
+            SaveState b;
+            vm.saveState(a);
+            copy.saveState(b);
+
+            checkSame(a, b, true, "frame " + std::to_string(i) + " after loading the file");
+        }
+
+        // The file is read in whole, so a missing byte at the end must be noticed
+        std::vector<char> bytes;
+
+        {
+            std::ifstream in(SAVE_STATE_PATH, std::ios::binary);
+            bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+
+        bytes.pop_back();
+
+        {
+            std::ofstream out(SAVE_STATE_PATH, std::ios::binary | std::ios::trunc);
+            out.write(bytes.data(), (std::streamsize) bytes.size());
+        }
+
+        try {
+            SaveState truncated(SAVE_STATE_PATH);
+            check(false, "a truncated file was read");
+        } catch (const InvalidSaveState &) {
+        }
+
+        VM other(cfg);
+        other.load({ 0x12, 0x00 }); // JP 0x200
+        other.setMode(VMMode::RUN);
+
+        try {
+            other.loadState(loaded);
+            check(false, "a save state of another ROM was loaded");
+        } catch (const InvalidSaveState &) {
+        }
+
+        std::remove(SAVE_STATE_PATH.c_str());
+    }
+
+    void testRewind(VM &vm) {
+        std::minstd_rand keys;
+        std::vector<SaveState> history(FRAMES);
+
+        for (auto &save : history) {
+            pressKeys(vm, keys);
+            vm.runFrame();
+            vm.saveState(save);
+        }
+
+        // The first rewind leaves the current frame, which is the newest one in the history
+        for (std::size_t i = FRAMES - 1; i > 0; --i) {
+            check(vm.rewind(), "the history ended at frame " + std::to_string(i));
+
+            SaveState rewound;
+            vm.saveState(rewound);
+
+            checkSame(history[i - 1], rewound, false, "frame " + std::to_string(i - 1));
+        }
+
+        check(!vm.rewind(), "the history goes back further than the frames that were emulated");
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: nchip8-state-tests <save-state-file|rewind> <ROM> [schip]\n";
+
+        return EXIT_FAILURE;
+    }
+
+    std::string test = argv[1];
+
+    try {
+        CPUConfig cfg;
+        cfg.cyclesPerSec = 2000;
+        // Enough for the whole test, so nothing is dropped from the history
+        cfg.rewindSeconds = FRAMES / TIMER_FREQ + 1;
+
+        VM vm(cfg);
+
+        if (argc > 3 && std::string(argv[3]) == "schip") {
+            vm.setExtension(Extension::SCHIP);
+        }
+
+        vm.loadFile(argv[2]);
+        vm.setMode(VMMode::RUN);
+
+        std::ifstream file(argv[2], std::ios::binary);
+        std::vector<std::uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        if (test == "save-state-file") {
+            testSaveStateFile(vm, rom, cfg);
+        } else if (test == "rewind") {
+            testRewind(vm);
+        } else {
+            std::cerr << "nchip8-state-tests: unknown test '" << test << "'\n";
+
+            return EXIT_FAILURE;
+        }
+    } catch (const std::exception &err) {
+        std::cerr << "nchip8-state-tests: " << test << ": " << err.what() << '\n';
+
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}